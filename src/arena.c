@@ -0,0 +1,139 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Linear arena for the transient data of a frame
+///////////////////////////////////////////////////////////////////////////////
+// Allocations are taken one after the other from a block and are never freed
+// one by one: arena_reset() releases all of them at once by rewinding the
+// block, so a frame costs no malloc or free at all once the arena is as big
+// as the largest frame.
+//
+// When a frame needs more, a new block is chained and the frame goes on in
+// it. At the next reset the chain is replaced by a single block sized for
+// the peak, with some headroom, so the arena only grows on frames that beat
+// the high-water mark.
+///////////////////////////////////////////////////////////////////////////////
+
+struct arena_block_t {
+    arena_block_t* previous;  // the block that filled up before this one
+    size_t size;
+    unsigned char* memory;    // first aligned byte after the header
+};
+
+static size_t align_size(size_t size) {
+    return (size + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+}
+
+static arena_block_t* new_block(arena_t* arena, size_t size, arena_block_t* previous) {
+    arena_block_t* block = (arena_block_t*)malloc(sizeof(arena_block_t) + ARENA_ALIGNMENT + size);
+    if (!block) {
+        return NULL;
+    }
+    uintptr_t address = (uintptr_t)(block + 1);
+    block->memory = (unsigned char*)((address + ARENA_ALIGNMENT - 1) & ~(uintptr_t)(ARENA_ALIGNMENT - 1));
+    block->size = size;
+    block->previous = previous;
+    arena->capacity += size;
+    arena->num_block_allocations++;
+    return block;
+}
+
+static void free_blocks(arena_t* arena) {
+    while (arena->block) {
+        arena_block_t* previous = arena->block->previous;
+        free(arena->block);
+        arena->block = previous;
+    }
+    arena->capacity = 0;
+}
+
+bool arena_init(arena_t* arena, size_t capacity) {
+    memset(arena, 0, sizeof(*arena));
+    arena->block = new_block(arena, align_size(capacity), NULL);
+    return arena->block != NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Take size bytes, aligned to ARENA_ALIGNMENT, valid until the next reset.
+// Running out of memory ends the program: a frame is never drawn short.
+///////////////////////////////////////////////////////////////////////////////
+void* arena_alloc(arena_t* arena, size_t size) {
+    size = align_size(size);
+    if (!arena->block || arena->used + size > arena->block->size) {
+        // Chain a block at least as big as all the others, so the chain stays short
+        size_t block_size = size > arena->capacity ? size : arena->capacity;
+        arena_block_t* block = new_block(arena, block_size, arena->block);
+        if (!block) {
+            fprintf(stderr, "Cannot grow the frame arena by %zu bytes\n", block_size);
+            exit(EXIT_FAILURE);
+        }
+        arena->block = block;
+        arena->used = 0;
+    }
+    void* memory = arena->block->memory + arena->used;
+    arena->used += size;
+    arena->frame_used += size;
+    if (arena->frame_used > arena->peak) {
+        arena->peak = arena->frame_used;
+    }
+    arena->last = memory;
+    return memory;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Resize an allocation to new_size bytes, keeping its contents. The most
+// recent allocation grows in place while its block has room, so an array
+// appended to between other allocations costs no copy; otherwise the
+// contents move to a new allocation and the old one is left until the reset.
+///////////////////////////////////////////////////////////////////////////////
+void* arena_grow(arena_t* arena, void* memory, size_t old_size, size_t new_size) {
+    if (!memory) {
+        return arena_alloc(arena, new_size);
+    }
+    if (memory == arena->last) {
+        size_t offset = (unsigned char*)memory - arena->block->memory;
+        size_t old_aligned = align_size(old_size);
+        size_t new_aligned = align_size(new_size);
+        if (offset + new_aligned <= arena->block->size) {
+            arena->used = offset + new_aligned;
+            arena->frame_used = arena->frame_used - old_aligned + new_aligned;
+            if (arena->frame_used > arena->peak) {
+                arena->peak = arena->frame_used;
+            }
+            return memory;
+        }
+    }
+    // The old copy is dead: a single block big enough for the frame would have grown in place
+    arena->frame_used -= align_size(old_size);
+    void* moved = arena_alloc(arena, new_size);
+    memcpy(moved, memory, old_size < new_size ? old_size : new_size);
+    return moved;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Release every allocation. This only rewinds the block, unless the frame
+// spilled into new blocks: then they are all replaced by a single one with
+// room for the peak and half of it again.
+///////////////////////////////////////////////////////////////////////////////
+void arena_reset(arena_t* arena) {
+    if (arena->block && arena->block->previous) {
+        free_blocks(arena);
+        arena->block = new_block(arena, align_size(arena->peak + arena->peak / 2), NULL);
+        if (!arena->block) {
+            fprintf(stderr, "Cannot allocate the frame arena\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    arena->used = 0;
+    arena->frame_used = 0;
+    arena->last = NULL;
+}
+
+void arena_free(arena_t* arena) {
+    free_blocks(arena);
+    memset(arena, 0, sizeof(*arena));
+}
@@ -0,0 +1,28 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Every allocation starts on a cache line, which is also a multiple of SOA_ALIGNMENT
+#define ARENA_ALIGNMENT 64
+
+typedef struct arena_block_t arena_block_t;
+
+typedef struct {
+    arena_block_t* block;     // block the allocations are taken from, the newest one
+    size_t used;              // bytes taken from it
+    size_t frame_used;        // bytes of the live allocations since the last reset, over all the blocks
+    size_t peak;              // largest frame_used of any frame
+    size_t capacity;          // total size of the blocks
+    int num_block_allocations; // times the arena called malloc
+    void* last;               // most recent allocation, the one arena_grow can extend in place
+} arena_t;
+
+bool arena_init(arena_t* arena, size_t capacity);
+void* arena_alloc(arena_t* arena, size_t size);
+void* arena_grow(arena_t* arena, void* memory, size_t old_size, size_t new_size);
+void arena_reset(arena_t* arena);
+void arena_free(arena_t* arena);
+
+#endif
@@ -1,40 +1,123 @@
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "array.h"
 
-#define ARRAY_RAW_DATA(array) ((int*)(array) - 2)
-#define ARRAY_CAPACITY(array) (ARRAY_RAW_DATA(array)[0])
-#define ARRAY_OCCUPIED(array) (ARRAY_RAW_DATA(array)[1])
-
-void* array_hold(void* array, int count, int item_size) {
-    if (array == NULL) {
-        int raw_size = (sizeof(int) * 2) + (item_size * count);
-        int* base = (int*)malloc(raw_size);
-        base[0] = count;  // capacity
-        base[1] = count;  // occupied
-        return base + 2;
-    } else if (ARRAY_OCCUPIED(array) + count <= ARRAY_CAPACITY(array)) {
-        ARRAY_OCCUPIED(array) += count;
+///////////////////////////////////////////////////////////////////////////////
+// Dynamic arrays
+///////////////////////////////////////////////////////////////////////////////
+// An array is a pointer to its first element, used like a plain C array. The
+// ARRAY_HEADER_SIZE bytes right before it hold the length, the capacity and
+// the block returned by malloc, which is a little larger than needed so the
+// elements can start on an ARRAY_ALIGNMENT boundary:
+//
+//   allocation      header            elements
+//   |<- padding ->| capacity length . | [0] [1] [2] ... [length-1] ...free... |
+//                                      ^ array, cache line aligned
+//
+// Arrays grow by doubling. array_reserve() and array_append() grow once to a
+// known size, so loaders that count first never copy an array twice.
+///////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    size_t capacity;
+    size_t length;
+    void* allocation;  // start of the malloc block, NULL when the caller owns the memory
+} array_header_t;
+
+#define ARRAY_HEADER(array) ((array_header_t*)((unsigned char*)(array) - ARRAY_HEADER_SIZE))
+
+// Move the array to a block with room for capacity elements, keeping its elements
+static void* array_resize(void* array, size_t capacity, size_t item_size) {
+    size_t length = array ? ARRAY_HEADER(array)->length : 0;
+    void* old_allocation = array ? ARRAY_HEADER(array)->allocation : NULL;
+    size_t old_offset = old_allocation ? (size_t)((unsigned char*)array - (unsigned char*)old_allocation) : 0;
+
+    size_t raw_size = ARRAY_ALIGNMENT - 1 + ARRAY_HEADER_SIZE + capacity * item_size;
+    unsigned char* allocation = (unsigned char*)realloc(old_allocation, raw_size);
+    if (!allocation) {
+        fprintf(stderr, "Cannot allocate an array of %zu elements\n", capacity);
+        exit(EXIT_FAILURE);
+    }
+
+    uintptr_t address = (uintptr_t)(allocation + ARRAY_HEADER_SIZE);
+    unsigned char* elements = (unsigned char*)((address + ARRAY_ALIGNMENT - 1) & ~(uintptr_t)(ARRAY_ALIGNMENT - 1));
+    if (array && !old_allocation) {
+        // The old elements are in memory the caller owns: copy them out
+        memcpy(elements, array, length * item_size);
+    } else if (array && (size_t)(elements - allocation) != old_offset) {
+        // realloc kept the bytes but not the alignment: slide them into place
+        memmove(elements, allocation + old_offset, length * item_size);
+    }
+
+    array_header_t* header = ARRAY_HEADER(elements);
+    header->capacity = capacity;
+    header->length = length;
+    header->allocation = allocation;
+    return elements;
+}
+
+// Grow the array to hold count more elements, doubling its capacity when it is full
+void* array_hold(void* array, size_t count, size_t item_size) {
+    size_t length = array_length(array);
+    size_t needed = length + count;
+    if (!array || needed > ARRAY_HEADER(array)->capacity) {
+        size_t capacity = array ? ARRAY_HEADER(array)->capacity * 2 : (count > 1 ? count : ARRAY_MIN_CAPACITY);
+        array = array_resize(array, needed > capacity ? needed : capacity, item_size);
+    }
+    ARRAY_HEADER(array)->length = needed;
+    return array;
+}
+
+void* array_reserve_items(void* array, size_t capacity, size_t item_size) {
+    if (!array || capacity > ARRAY_HEADER(array)->capacity) {
+        array = array_resize(array, capacity, item_size);
+    }
+    return array;
+}
+
+void* array_append_items(void* array, const void* values, size_t count, size_t item_size) {
+    if (count == 0) {
         return array;
-    } else {
-        int needed_size = ARRAY_OCCUPIED(array) + count;
-        int double_curr = ARRAY_CAPACITY(array) * 2;
-        int capacity = needed_size > double_curr ? needed_size : double_curr;
-        int occupied = needed_size;
-        int raw_size = sizeof(int) * 2 + item_size * capacity;
-        int* base = (int*)realloc(ARRAY_RAW_DATA(array), raw_size);
-        base[0] = capacity;
-        base[1] = occupied;
-        return base + 2;
     }
+    size_t length = array_length(array);
+    array = array_hold(array, count, item_size);
+    memcpy((unsigned char*)array + length * item_size, values, count * item_size);
+    return array;
+}
+
+void* array_shrink_items(void* array, size_t item_size) {
+    if (array && ARRAY_HEADER(array)->allocation && ARRAY_HEADER(array)->capacity > ARRAY_HEADER(array)->length) {
+        array = array_resize(array, ARRAY_HEADER(array)->length, item_size);
+    }
+    return array;
+}
+
+// Lay out a full array of count elements in memory the caller owns, which must
+// have ARRAY_HEADER_SIZE bytes before the elements. Returns the array pointer.
+// The array can be read with the usual functions; growing it copies it out to
+// a block of its own, and freeing it leaves the memory alone.
+void* array_place(void* memory, size_t count) {
+    memset(memory, 0, ARRAY_HEADER_SIZE);
+    void* array = (unsigned char*)memory + ARRAY_HEADER_SIZE;
+    array_header_t* header = ARRAY_HEADER(array);
+    header->capacity = count;
+    header->length = count;
+    header->allocation = NULL;
+    return array;
+}
+
+size_t array_length(const void* array) {
+    return (array != NULL) ? ARRAY_HEADER(array)->length : 0;
 }
 
-int array_length(void* array) {
-    return (array != NULL) ? ARRAY_OCCUPIED(array) : 0;
+size_t array_capacity(const void* array) {
+    return (array != NULL) ? ARRAY_HEADER(array)->capacity : 0;
 }
 
 void array_free(void* array) {
     if (array != NULL) {
-        free(ARRAY_RAW_DATA(array));
+        free(ARRAY_HEADER(array)->allocation);
     }
 }
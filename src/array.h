@@ -1,14 +1,40 @@
 #ifndef ARRAY_H
 #define ARRAY_H
 
+#include <stddef.h>
+
 #define array_push(array, value)                                              \
     do {                                                                      \
         (array) = array_hold((array), 1, sizeof(*(array)));                   \
         (array)[array_length(array) - 1] = (value);                           \
     } while (0);
 
-void* array_hold(void* array, int count, int item_size);
-int array_length(void* array);
+// Make room for at least capacity elements in total, keeping the length
+#define array_reserve(array, capacity)                                        \
+    ((array) = array_reserve_items((array), (capacity), sizeof(*(array))))
+
+// Append count elements copied from values, growing the array once
+#define array_append(array, values, count)                                    \
+    ((array) = array_append_items((array), (values), (count), sizeof(*(array))))
+
+// Give back the capacity beyond the length
+#define array_shrink(array)                                                   \
+    ((array) = array_shrink_items((array), sizeof(*(array))))
+
+// The elements start on a cache line, right after a header of a whole cache line
+#define ARRAY_ALIGNMENT 64
+#define ARRAY_HEADER_SIZE ARRAY_ALIGNMENT
+
+// Capacity of a new array grown one element at a time
+#define ARRAY_MIN_CAPACITY 16
+
+void* array_hold(void* array, size_t count, size_t item_size);
+void* array_reserve_items(void* array, size_t capacity, size_t item_size);
+void* array_append_items(void* array, const void* values, size_t count, size_t item_size);
+void* array_shrink_items(void* array, size_t item_size);
+void* array_place(void* memory, size_t count);
+size_t array_length(const void* array);
+size_t array_capacity(const void* array);
 void array_free(void* array);
 
-#endif
\ No newline at end of file
+#endif
@@ -1,8 +1,48 @@
 #include <math.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "clipping.h"
 
-#define NUM_PLANES 6
-plane_t frustum_planes[NUM_PLANES];
+plane_t frustum_planes[NUM_FRUSTUM_PLANES];
+
+///////////////////////////////////////////////////////////////////////////////
+// The same planes in homogeneous clip space, after the projection matrix,
+// plus the guard band. A vertex P is in front of plane C when
+// dot(C, P) > 0, with the terms in the order of clip_distance():
+//
+//   left   x > -w     right  x < w      near  z > 0
+//   bottom y > -w     top    y < w      far   z < w
+//
+// and the guard band planes are the side planes with w scaled by
+// GUARD_BAND_SCALE.
+///////////////////////////////////////////////////////////////////////////////
+static const vec4_t clip_planes[NUM_CLIP_PLANES] = {
+    [LEFT_FRUSTUM_PLANE]      = {  1,  0,  0, 1 },
+    [RIGHT_FRUSTUM_PLANE]     = { -1,  0,  0, 1 },
+    [TOP_FRUSTUM_PLANE]       = {  0, -1,  0, 1 },
+    [BOTTOM_FRUSTUM_PLANE]    = {  0,  1,  0, 1 },
+    [NEAR_FRUSTUM_PLANE]      = {  0,  0,  1, 0 },
+    [FAR_FRUSTUM_PLANE]       = {  0,  0, -1, 1 },
+    [LEFT_GUARD_BAND_PLANE]   = {  1,  0,  0, GUARD_BAND_SCALE },
+    [RIGHT_GUARD_BAND_PLANE]  = { -1,  0,  0, GUARD_BAND_SCALE },
+    [TOP_GUARD_BAND_PLANE]    = {  0, -1,  0, GUARD_BAND_SCALE },
+    [BOTTOM_GUARD_BAND_PLANE] = {  0,  1,  0, GUARD_BAND_SCALE }
+};
+
+static float clip_distance(vec4_t plane, vec4_t p) {
+    return ((plane.x * p.x + plane.y * p.y) + plane.z * p.z) + plane.w * p.w;
+}
+
+static bool guard_band_clipping = true;
+
+bool get_guard_band_clipping(void) {
+    return guard_band_clipping;
+}
+
+void set_guard_band_clipping(bool enabled) {
+    guard_band_clipping = enabled;
+}
 
 ///////////////////////////////////////////////////////////////////////////////
 // Frustum planes are defined by a point and a normal vector
@@ -13,6 +53,9 @@ plane_t frustum_planes[NUM_PLANES];
 // Bottom plane :  P=(0, 0, 0),     N=(0, cos(fovy/2), sin(fovy/2))
 // Left plane   :  P=(0, 0, 0),     N=(cos(fovx/2), 0, sin(fovx/2))
 // Right plane  :  P=(0, 0, 0),     N=(-cos(fovx/2), 0, sin(fovx/2))
+//
+// They are used to cull bounding volumes in camera space, the polygons are
+// clipped against clip_planes.
 ///////////////////////////////////////////////////////////////////////////////
 //
 //           /|\
@@ -63,7 +106,7 @@ void init_frustum_planes(float fov_x, float fov_y, float z_near, float z_far) {
 	frustum_planes[FAR_FRUSTUM_PLANE].normal.z = -1;
 }
 
-polygon_t polygon_from_triangle(vec3_t v0, vec3_t v1, vec3_t v2) {
+polygon_t polygon_from_triangle(clip_vertex_t v0, clip_vertex_t v1, clip_vertex_t v2) {
     polygon_t polygon = {
         .vertices = { v0, v1, v2 },
         .num_vertices = 3
@@ -77,52 +120,59 @@ void triangles_from_polygon(polygon_t* polygon, triangle_t triangles[], int* num
         int index1 = i + 1;
         int index2 = i + 2;
 
-        triangles[i].points[0] = vec4_from_vec3(polygon->vertices[index0]);
-        triangles[i].points[1] = vec4_from_vec3(polygon->vertices[index1]);
-        triangles[i].points[2] = vec4_from_vec3(polygon->vertices[index2]);
+        triangles[i].points[0] = polygon->vertices[index0].position;
+        triangles[i].points[1] = polygon->vertices[index1].position;
+        triangles[i].points[2] = polygon->vertices[index2].position;
+        triangles[i].texcoords[0] = polygon->vertices[index0].texcoord;
+        triangles[i].texcoords[1] = polygon->vertices[index1].texcoord;
+        triangles[i].texcoords[2] = polygon->vertices[index2].texcoord;
     }
     *num_triangles = polygon->num_vertices - 2;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Sutherland-Hodgman against one clip space plane. Position and attributes
+// are interpolated together, as one run of CLIP_VERTEX_FLOATS floats:
+// clip space is linear in the model, so the UVs stay exact.
+///////////////////////////////////////////////////////////////////////////////
 void clip_polygon_against_plane(polygon_t* polygon, int plane) {
-    vec3_t plane_point = frustum_planes[plane].point;
-    vec3_t plane_normal = frustum_planes[plane].normal;
+    vec4_t clip_plane = clip_planes[plane];
 
     // Declare a static array of inside vertices that will be part of the final polygon returned via parameter
-    vec3_t inside_vertices[MAX_NUM_POLY_VERTICES];
+    clip_vertex_t inside_vertices[MAX_NUM_POLY_VERTICES];
     int num_inside_vertices = 0;
 
     // Start the current vertex with the first polygon vertex, and the previous with the last polygon vertex
-    vec3_t* current_vertex = &polygon->vertices[0];
-    vec3_t* previous_vertex = &polygon->vertices[polygon->num_vertices - 1];
+    clip_vertex_t* current_vertex = &polygon->vertices[0];
+    clip_vertex_t* previous_vertex = &polygon->vertices[polygon->num_vertices - 1];
 
-    // Calculate the dot product of the current and previous vertex
-    float current_dot = 0; 
-    float previous_dot = vec3_dot(vec3_sub(*previous_vertex, plane_point), plane_normal);
+    // Calculate the signed distance of the current and previous vertex
+    float current_dot = 0;
+    float previous_dot = clip_distance(clip_plane, previous_vertex->position);
 
     // Loop all the polygon vertices while the current is different than the last one
     while (current_vertex != &polygon->vertices[polygon->num_vertices]) {
-        current_dot = vec3_dot(vec3_sub(*current_vertex, plane_point), plane_normal);
+        current_dot = clip_distance(clip_plane, current_vertex->position);
 
         // If we changed from inside to outside or from outside to inside
         if (current_dot * previous_dot < 0) {
             // Find the interpolation factor t
             float t = previous_dot / (previous_dot - current_dot);
-            // Calculate the intersection point I = Q1 + t(Q2-Q1)
-            vec3_t intersection_point = vec3_clone(current_vertex);              // I =        Qc
-            intersection_point = vec3_sub(intersection_point, *previous_vertex); // I =       (Qc-Qp)
-            intersection_point = vec3_mul(intersection_point, t);                // I =      t(Qc-Qp)
-            intersection_point = vec3_add(intersection_point, *previous_vertex); // I = Qp + t(Qc-Qp)
-
-            // Insert the intersection point to the list of "inside vertices"
-            inside_vertices[num_inside_vertices] = vec3_clone(&intersection_point);
+
+            // Calculate the intersection I = Qp + t(Qc-Qp) of every float of the vertex
+            const float* qp = (const float*)previous_vertex;
+            const float* qc = (const float*)current_vertex;
+            float* intersection = (float*)&inside_vertices[num_inside_vertices];
+            for (int k = 0; k < (int)CLIP_VERTEX_FLOATS; k++) {
+                intersection[k] = qp[k] + t * (qc[k] - qp[k]);
+            }
             num_inside_vertices++;
         }
 
         // Current vertex is inside the plane
         if (current_dot > 0) {
             // Insert the current vertex to the list of "inside vertices"
-            inside_vertices[num_inside_vertices] = vec3_clone(current_vertex);
+            inside_vertices[num_inside_vertices] = *current_vertex;
             num_inside_vertices++;
         }
 
@@ -131,19 +181,136 @@ void clip_polygon_against_plane(polygon_t* polygon, int plane) {
         previous_vertex = current_vertex;
         current_vertex++;
     }
-    
+
     // At the end, copy the list of inside vertices into the destination polygon (out parameter)
     for (int i = 0; i < num_inside_vertices; i++) {
-        polygon->vertices[i] = vec3_clone(&inside_vertices[i]);
+        polygon->vertices[i] = inside_vertices[i];
     }
     polygon->num_vertices = num_inside_vertices;
 }
 
-void clip_polygon(polygon_t* polygon) {
-    clip_polygon_against_plane(polygon, LEFT_FRUSTUM_PLANE);
-    clip_polygon_against_plane(polygon, RIGHT_FRUSTUM_PLANE);
-    clip_polygon_against_plane(polygon, TOP_FRUSTUM_PLANE);
-    clip_polygon_against_plane(polygon, BOTTOM_FRUSTUM_PLANE);
-    clip_polygon_against_plane(polygon, NEAR_FRUSTUM_PLANE);
-    clip_polygon_against_plane(polygon, FAR_FRUSTUM_PLANE);
+///////////////////////////////////////////////////////////////////////////////
+// Outcode bits of the planes the faces must be clipped against. Without the
+// guard band those are the six frustum planes. With it, the rasterizers
+// scissor anything that sticks out of the screen, so a face only needs
+// clipping where it crosses the near or far plane, or leaves the guard band.
+///////////////////////////////////////////////////////////////////////////////
+int get_clip_outcodes(void) {
+    return guard_band_clipping ? OUTCODE_NEAR_FAR | OUTCODE_GUARD_BAND : OUTCODE_FRUSTUM;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Clip the polygon against the planes whose outcode bits are set. Planes
+// that no vertex is behind would leave the polygon as it is, so passing the
+// union of the outcodes of the vertices saves those passes.
+///////////////////////////////////////////////////////////////////////////////
+void clip_polygon(polygon_t* polygon, int planes) {
+    for (int plane = 0; plane < NUM_CLIP_PLANES; plane++) {
+        if (planes & OUTCODE(plane)) {
+            clip_polygon_against_plane(polygon, plane);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Outcodes of the first count clip space vertices, 4 at a time with SSE2.
+// A vertex is flagged for a plane unless it passes the same strict test
+// clip_polygon uses to keep it, so for the three vertices of a face:
+//
+//   (a & b & c) & OUTCODE_FRUSTUM != 0       every vertex is behind one frustum plane: nothing is visible
+//   (a | b | c) & get_clip_outcodes() == 0   clipping would change nothing
+//
+// and only the faces in between need clip_polygon.
+///////////////////////////////////////////////////////////////////////////////
+void compute_outcodes(const vec4_soa_t* vertices, int count, uint16_t* outcodes) {
+    int i = 0;
+#if defined(__SSE2__)
+    __m128 plane_x[NUM_CLIP_PLANES], plane_y[NUM_CLIP_PLANES], plane_z[NUM_CLIP_PLANES], plane_w[NUM_CLIP_PLANES];
+    __m128i plane_bit[NUM_CLIP_PLANES];
+    for (int p = 0; p < NUM_CLIP_PLANES; p++) {
+        plane_x[p] = _mm_set1_ps(clip_planes[p].x);
+        plane_y[p] = _mm_set1_ps(clip_planes[p].y);
+        plane_z[p] = _mm_set1_ps(clip_planes[p].z);
+        plane_w[p] = _mm_set1_ps(clip_planes[p].w);
+        plane_bit[p] = _mm_set1_epi32(OUTCODE(p));
+    }
+    __m128 zero = _mm_setzero_ps();
+    for (; i + 4 <= count; i += 4) {
+        __m128 x = _mm_load_ps(&vertices->x[i]);
+        __m128 y = _mm_load_ps(&vertices->y[i]);
+        __m128 z = _mm_load_ps(&vertices->z[i]);
+        __m128 w = _mm_load_ps(&vertices->w[i]);
+        __m128i codes = _mm_setzero_si128();
+        for (int p = 0; p < NUM_CLIP_PLANES; p++) {
+            // clip_distance(), term by term in the same order so the results match the clipper
+            __m128 distance = _mm_add_ps(_mm_mul_ps(plane_x[p], x), _mm_mul_ps(plane_y[p], y));
+            distance = _mm_add_ps(distance, _mm_mul_ps(plane_z[p], z));
+            distance = _mm_add_ps(distance, _mm_mul_ps(plane_w[p], w));
+            __m128i behind = _mm_castps_si128(_mm_cmpngt_ps(distance, zero));
+            codes = _mm_or_si128(codes, _mm_and_si128(behind, plane_bit[p]));
+        }
+        // Narrow the four 32-bit codes down to 16 bits
+        _mm_storel_epi64((__m128i*)&outcodes[i], _mm_packs_epi32(codes, codes));
+    }
+#endif
+    for (; i < count; i++) {
+        vec4_t v = { vertices->x[i], vertices->y[i], vertices->z[i], vertices->w[i] };
+        uint16_t code = 0;
+        for (int p = 0; p < NUM_CLIP_PLANES; p++) {
+            if (!(clip_distance(clip_planes[p], v) > 0)) {
+                code |= OUTCODE(p);
+            }
+        }
+        outcodes[i] = code;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A sphere is outside the frustum when it lies entirely behind one plane
+///////////////////////////////////////////////////////////////////////////////
+bool sphere_outside_frustum(vec3_t center, float radius) {
+    for (int i = 0; i < NUM_FRUSTUM_PLANES; i++) {
+        vec3_t offset = vec3_sub(center, frustum_planes[i].point);
+        if (vec3_dot(offset, frustum_planes[i].normal) < -radius) {
+            return true;
+        }
+    }
+    return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Classify the bounds of an object, in camera space: a sphere and the eight
+// corners of a box around the same vertices. The sphere settles most objects
+// with one distance per plane. When it crosses a plane the box decides: it is
+// outside when all its corners are behind one plane, and inside when every
+// corner is strictly in front of every plane.
+///////////////////////////////////////////////////////////////////////////////
+frustum_test_t classify_bounds_in_frustum(vec3_t center, float radius, const vec3_t corners[8]) {
+    bool sphere_inside = true;
+    for (int i = 0; i < NUM_FRUSTUM_PLANES; i++) {
+        float distance = vec3_dot(vec3_sub(center, frustum_planes[i].point), frustum_planes[i].normal);
+        if (distance < -radius) {
+            return FRUSTUM_OUTSIDE;
+        }
+        sphere_inside &= distance > radius;
+    }
+    if (sphere_inside) {
+        return FRUSTUM_INSIDE;
+    }
+
+    frustum_test_t result = FRUSTUM_INSIDE;
+    for (int i = 0; i < NUM_FRUSTUM_PLANES; i++) {
+        int num_in_front = 0;
+        for (int k = 0; k < 8; k++) {
+            float distance = vec3_dot(vec3_sub(corners[k], frustum_planes[i].point), frustum_planes[i].normal);
+            num_in_front += distance > 0;
+        }
+        if (num_in_front == 0) {
+            return FRUSTUM_OUTSIDE;
+        }
+        if (num_in_front < 8) {
+            result = FRUSTUM_INTERSECTING;
+        }
+    }
+    return result;
 }
@@ -1,6 +1,8 @@
 #ifndef CLIPPING_H
 #define CLIPPING_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include "triangle.h"
 #include "vector.h"
 
@@ -13,22 +15,59 @@ enum {
     TOP_FRUSTUM_PLANE,
     BOTTOM_FRUSTUM_PLANE,
     NEAR_FRUSTUM_PLANE,
-    FAR_FRUSTUM_PLANE
+    FAR_FRUSTUM_PLANE,
+    LEFT_GUARD_BAND_PLANE,
+    RIGHT_GUARD_BAND_PLANE,
+    TOP_GUARD_BAND_PLANE,
+    BOTTOM_GUARD_BAND_PLANE
 };
 
+#define NUM_FRUSTUM_PLANES 6
+#define NUM_CLIP_PLANES 10
+
+// The guard band is this many times as wide and as tall as the screen, around its center
+#define GUARD_BAND_SCALE 4.0
+
+// Outcode of a clip space vertex: one bit per clip plane, set when the vertex is not in front of it
+#define OUTCODE(plane) (1 << (plane))
+#define OUTCODE_FRUSTUM (OUTCODE(NUM_FRUSTUM_PLANES) - 1)
+#define OUTCODE_NEAR_FAR (OUTCODE(NEAR_FRUSTUM_PLANE) | OUTCODE(FAR_FRUSTUM_PLANE))
+#define OUTCODE_GUARD_BAND (OUTCODE(NUM_CLIP_PLANES) - OUTCODE(NUM_FRUSTUM_PLANES))
+
 typedef struct {
     vec3_t point;
     vec3_t normal;
 } plane_t;
 
+// Where a bounding volume lies relative to the frustum
+typedef enum {
+    FRUSTUM_OUTSIDE,
+    FRUSTUM_INTERSECTING,
+    FRUSTUM_INSIDE
+} frustum_test_t;
+
+// A polygon vertex: its clip space position, then the attributes interpolated along with it
+typedef struct {
+    vec4_t position;
+    tex2_t texcoord;
+} clip_vertex_t;
+
+#define CLIP_VERTEX_FLOATS (sizeof(clip_vertex_t) / sizeof(float))
+
 typedef struct {
-    vec3_t vertices[MAX_NUM_POLY_VERTICES];
+    clip_vertex_t vertices[MAX_NUM_POLY_VERTICES];
     int num_vertices;
 } polygon_t;
 
 void init_frustum_planes(float fov_x, float fov_y, float z_near, float z_far);
-polygon_t polygon_from_triangle(vec3_t v0, vec3_t v1, vec3_t v2);
+polygon_t polygon_from_triangle(clip_vertex_t v0, clip_vertex_t v1, clip_vertex_t v2);
 void triangles_from_polygon(polygon_t* polygon, triangle_t triangles[], int* num_triangles);
-void clip_polygon(polygon_t* polygon);
+void clip_polygon(polygon_t* polygon, int planes);
+void compute_outcodes(const vec4_soa_t* vertices, int count, uint16_t* outcodes);
+int get_clip_outcodes(void);
+bool get_guard_band_clipping(void);
+void set_guard_band_clipping(bool enabled);
+bool sphere_outside_frustum(vec3_t center, float radius);
+frustum_test_t classify_bounds_in_frustum(vec3_t center, float radius, const vec3_t corners[8]);
 
 #endif
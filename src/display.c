@@ -1,3 +1,6 @@
+#include <float.h>
+#include <math.h>
+#include <string.h>
 #include "display.h"
 #include "color.h"
 
@@ -7,6 +10,14 @@ SDL_Renderer* renderer = NULL;
 uint32_t* color_buffer = NULL;
 float* z_buffer = NULL;
 
+// Farthest depth stored in each HIZ_BLOCK_SIZE x HIZ_BLOCK_SIZE block of the z-buffer.
+// It is always an upper bound: writes that do not refresh it only make it conservative.
+float* hiz_buffer = NULL;
+
+// Index of the triangle visible at each pixel, written instead of a color by the visibility pass
+// of deferred texturing. Only meaningful where the z-buffer holds a depth written this frame.
+uint32_t* visibility_buffer = NULL;
+
 SDL_Texture* color_buffer_texture = NULL;
 
 static int window_width = 800;
@@ -14,6 +25,25 @@ static int window_height = 600;
 
 static int render_method = RENDER_WIRE;
 static int cull_method = CULL_BACKFACE;
+static int raster_method = RASTER_HALFSPACE;
+static bool hiz_culling = true;
+static bool deferred_texturing = false;
+static bool depth_sorting = false;
+
+// The z-buffer is never cleared: each frame stores its depths d in [0, 1) as
+// depth_scale * (1 + d), with depth_scale half that of the frame before. The
+// depths of a frame therefore all sit in [depth_scale, 2 * depth_scale) and
+// compare nearer than anything an earlier frame left behind. Once the scale
+// reaches DEPTH_EPOCH_MIN_EXPONENT the buffer is filled once and the scale
+// goes back to 2^DEPTH_EPOCH_MAX_EXPONENT, about every 200 frames.
+#define DEPTH_EPOCH_MAX_EXPONENT 126
+#define DEPTH_EPOCH_MIN_EXPONENT -96
+
+static int depth_exponent = DEPTH_EPOCH_MIN_EXPONENT;  // forces a fill on the first frame
+static float depth_scale = 0;
+
+// Tiles of the color buffer written since they were last cleared
+static uint8_t* dirty_tiles = NULL;
 
 
 int get_render_method(void) {
@@ -32,6 +62,38 @@ void set_cull_method(int method) {
     cull_method = method;
 }
 
+int get_raster_method(void) {
+    return raster_method;
+}
+
+void set_raster_method(int method) {
+    raster_method = method;
+}
+
+bool get_hiz_culling(void) {
+    return hiz_culling;
+}
+
+void set_hiz_culling(bool enabled) {
+    hiz_culling = enabled;
+}
+
+bool get_deferred_texturing(void) {
+    return deferred_texturing;
+}
+
+void set_deferred_texturing(bool enabled) {
+    deferred_texturing = enabled;
+}
+
+bool get_depth_sorting(void) {
+    return depth_sorting;
+}
+
+void set_depth_sorting(bool enabled) {
+    depth_sorting = enabled;
+}
+
 int get_window_width(void) {
     return window_width;
 }
@@ -75,6 +137,10 @@ bool initialize_window(void) {
 
     color_buffer = (uint32_t*) malloc(sizeof(uint32_t) * window_width * window_height);
     z_buffer = (float *)malloc(sizeof(float) * window_width * window_height);
+    hiz_buffer = (float *)malloc(sizeof(float) * get_hiz_width() * get_hiz_height());
+    visibility_buffer = (uint32_t*)malloc(sizeof(uint32_t) * window_width * window_height);
+    dirty_tiles = (uint8_t*)malloc(get_dirty_tiles_x() * get_dirty_tiles_y());
+    invalidate_color_buffer();
     
     // Create a SDL Texture for the color display
     color_buffer_texture = SDL_CreateTexture(
@@ -147,21 +213,127 @@ void render_color_buffer(void) {
     SDL_RenderPresent(renderer);
 }
 
-void clear_color_buffer(uint32_t color) {
-    for (int i = 0; i < window_width * window_height; i++) {
-        color_buffer[i] = color;
+///////////////////////////////////////////////////////////////////////////////
+// Copy the background image (window sized) into the tiles that were drawn to
+// since their last clear. The others already hold it, so a new background
+// must be preceded by invalidate_color_buffer().
+///////////////////////////////////////////////////////////////////////////////
+void clear_color_buffer(const uint32_t* background) {
+    int tiles_x = get_dirty_tiles_x();
+    int tiles_y = get_dirty_tiles_y();
+    for (int tile_y = 0; tile_y < tiles_y; tile_y++) {
+        int y0 = tile_y * DIRTY_TILE_SIZE;
+        int y1 = y0 + DIRTY_TILE_SIZE < window_height ? y0 + DIRTY_TILE_SIZE : window_height;
+        int tile_x = 0;
+        while (tile_x < tiles_x) {
+            int tile = tile_y * tiles_x + tile_x;
+            if (!dirty_tiles[tile]) {
+                tile_x++;
+                continue;
+            }
+            // Clear the whole run of dirty tiles with one span per row
+            int first_tile_x = tile_x;
+            while (tile_x < tiles_x && dirty_tiles[tile_y * tiles_x + tile_x]) {
+                dirty_tiles[tile_y * tiles_x + tile_x] = false;
+                tile_x++;
+            }
+            int x0 = first_tile_x * DIRTY_TILE_SIZE;
+            int x1 = tile_x * DIRTY_TILE_SIZE < window_width ? tile_x * DIRTY_TILE_SIZE : window_width;
+            for (int y = y0; y < y1; y++) {
+                memcpy(&color_buffer[window_width * y + x0], &background[window_width * y + x0], sizeof(uint32_t) * (x1 - x0));
+            }
+        }
+    }
+}
+
+// Have the next clear_color_buffer reset every tile
+void invalidate_color_buffer(void) {
+    memset(dirty_tiles, true, get_dirty_tiles_x() * get_dirty_tiles_y());
+}
+
+// Record that pixels min_x..max_x, min_y..max_y (inclusive) may be drawn to this frame
+void mark_dirty_rect(int min_x, int min_y, int max_x, int max_y) {
+    if (min_x < 0) min_x = 0;
+    if (min_y < 0) min_y = 0;
+    if (max_x > window_width - 1) max_x = window_width - 1;
+    if (max_y > window_height - 1) max_y = window_height - 1;
+    if (min_x > max_x || min_y > max_y) {
+        return;
+    }
+    int tiles_x = get_dirty_tiles_x();
+    for (int tile_y = min_y / DIRTY_TILE_SIZE; tile_y <= max_y / DIRTY_TILE_SIZE; tile_y++) {
+        for (int tile_x = min_x / DIRTY_TILE_SIZE; tile_x <= max_x / DIRTY_TILE_SIZE; tile_x++) {
+            dirty_tiles[tile_y * tiles_x + tile_x] = true;
+        }
     }
 }
 
+// Mark the screen bounding box of a triangle, widened to cover its vertex points
+void mark_triangle_dirty(const triangle_t* triangle) {
+    float min_x = fminf(triangle->points[0].x, fminf(triangle->points[1].x, triangle->points[2].x));
+    float min_y = fminf(triangle->points[0].y, fminf(triangle->points[1].y, triangle->points[2].y));
+    float max_x = fmaxf(triangle->points[0].x, fmaxf(triangle->points[1].x, triangle->points[2].x));
+    float max_y = fmaxf(triangle->points[0].y, fmaxf(triangle->points[1].y, triangle->points[2].y));
+    // Guard band triangles can reach far outside the screen: clamp before converting
+    min_x = fmaxf(min_x, -DIRTY_TILE_SIZE);
+    min_y = fmaxf(min_y, -DIRTY_TILE_SIZE);
+    max_x = fminf(max_x, window_width + DIRTY_TILE_SIZE);
+    max_y = fminf(max_y, window_height + DIRTY_TILE_SIZE);
+    mark_dirty_rect(
+        (int)floorf(min_x) - DIRTY_MARGIN, (int)floorf(min_y) - DIRTY_MARGIN,
+        (int)ceilf(max_x) + DIRTY_MARGIN, (int)ceilf(max_y) + DIRTY_MARGIN
+    );
+}
+
+int get_dirty_tiles_x(void) {
+    return (window_width + DIRTY_TILE_SIZE - 1) / DIRTY_TILE_SIZE;
+}
+
+int get_dirty_tiles_y(void) {
+    return (window_height + DIRTY_TILE_SIZE - 1) / DIRTY_TILE_SIZE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Start a new depth epoch. This only halves depth_scale, except once every
+// epoch span, when the z-buffer and the hierarchical z-buffer are filled
+// with a depth farther than any epoch.
+///////////////////////////////////////////////////////////////////////////////
 void clear_z_buffer(void) {
-    for (int i = 0; i < window_width * window_height; i++) {
-            z_buffer[i] = 1.0; 
+    if (depth_exponent > DEPTH_EPOCH_MIN_EXPONENT) {
+        depth_exponent--;
+    } else {
+        for (int i = 0; i < window_width * window_height; i++) {
+            z_buffer[i] = FLT_MAX;
+        }
+        for (int i = 0; i < get_hiz_width() * get_hiz_height(); i++) {
+            hiz_buffer[i] = FLT_MAX;
+        }
+        depth_exponent = DEPTH_EPOCH_MAX_EXPONENT;
     }
+    depth_scale = ldexpf(1.0f, depth_exponent);
+}
+
+float get_depth_scale(void) {
+    return depth_scale;
+}
+
+// Stored depths at or above this were written by an earlier frame
+float get_depth_far(void) {
+    return 2 * depth_scale;
+}
+
+// Depth stored in the z-buffer this frame for a pixel with the given 1/w:
+// 1 - 1/w, so the pixels closer to the camera have smaller values, in the current epoch
+float encode_depth(float reciprocal_w) {
+    return 2 * depth_scale - depth_scale * reciprocal_w;
 }
 
 void destroy_window(void) {
     free(color_buffer);
     free(z_buffer);
+    free(hiz_buffer);
+    free(visibility_buffer);
+    free(dirty_tiles);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -197,19 +369,23 @@ void draw_grid_as_dots(int grid_size) {
     }
 }
 
+// Whole rows, then whole columns, instead of testing every pixel
 void draw_grid_as_lines(int grid_size) {
-    for (int y = 0; y < window_height; y++) {
+    for (int y = 0; y < window_height; y += grid_size) {
         for (int x = 0; x < window_width; x++) {
-            if (x % grid_size == 0 || y % grid_size == 0) {
-                color_buffer[place_in_buffer(x, y)] = GRAY;
-            }
+            color_buffer[place_in_buffer(x, y)] = GRAY;
+        }
+    }
+    for (int y = 0; y < window_height; y++) {
+        for (int x = 0; x < window_width; x += grid_size) {
+            color_buffer[place_in_buffer(x, y)] = GRAY;
         }
     }
 }
 
 float get_zbuffer_at(int x, int y) {
     if (x < 0 || x >= window_width || y < 0 || y >= window_height) {
-        return 1.0;
+        return FLT_MAX;
     }
 
     return z_buffer[place_in_buffer(x, y)];
@@ -223,6 +399,32 @@ void update_zbuffer_at(int x, int y, float value) {
     z_buffer[place_in_buffer(x, y)] = value;
 }
 
+int get_hiz_width(void) {
+    return (window_width + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE;
+}
+
+int get_hiz_height(void) {
+    return (window_height + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE;
+}
+
+// Recompute the farthest depth of a block after some of its pixels were written
+void update_hiz_block(int block_x, int block_y) {
+    int x0 = block_x * HIZ_BLOCK_SIZE;
+    int y0 = block_y * HIZ_BLOCK_SIZE;
+    int x1 = x0 + HIZ_BLOCK_SIZE < window_width ? x0 + HIZ_BLOCK_SIZE : window_width;
+    int y1 = y0 + HIZ_BLOCK_SIZE < window_height ? y0 + HIZ_BLOCK_SIZE : window_height;
+
+    float max_depth = 0;
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            float depth = z_buffer[place_in_buffer(x, y)];
+            if (depth > max_depth) {
+                max_depth = depth;
+            }
+        }
+    }
+    hiz_buffer[block_y * get_hiz_width() + block_x] = max_depth;
+}
 
 bool should_render_solid() {
     if (render_method == RENDER_SOLID || render_method == RENDER_WIRE_SOLID) {
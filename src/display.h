@@ -7,6 +7,15 @@
 
 #include "triangle.h"
 
+// Side of the square blocks of pixels summarized by one hierarchical z-buffer entry
+#define HIZ_BLOCK_SIZE 8
+
+// Side of the square tiles the color buffer tracks, to clear only what was drawn to
+#define DIRTY_TILE_SIZE 32
+
+// Pixels around a triangle's bounding box that its wireframe and vertex points may reach
+#define DIRTY_MARGIN 4
+
 #define FPS 60
 #define FRAME_TARGET_TIME (1000 / FPS)  // 33.3ms
 
@@ -14,6 +23,8 @@ extern SDL_Window* window;
 extern SDL_Renderer* renderer;
 extern uint32_t* color_buffer;
 extern float* z_buffer;
+extern float* hiz_buffer;
+extern uint32_t* visibility_buffer;
 
 enum render_modes {
     RENDER_WIRE,
@@ -29,6 +40,13 @@ enum cull_modes {
     CULL_BACKFACE
 };
 
+enum raster_modes {
+    RASTER_SCANLINE,
+    RASTER_HALFSPACE,
+    RASTER_SUBPIXEL,
+    NUM_RASTER_MODES
+};
+
 static int render_method;
 static int cull_method;
 
@@ -42,14 +60,30 @@ int get_render_method(void);
 void set_render_method(int method);
 int get_cull_method(void);
 void set_cull_method(int method);
+int get_raster_method(void);
+void set_raster_method(int method);
+bool get_hiz_culling(void);
+void set_hiz_culling(bool enabled);
+bool get_deferred_texturing(void);
+void set_deferred_texturing(bool enabled);
+bool get_depth_sorting(void);
+void set_depth_sorting(bool enabled);
 bool initialize_window(void);
 void draw_rect(int x, int y, int width, int height, uint32_t color);
 void draw_grid_as_dots(int grid_size);
 void draw_grid_as_lines(int grid_size);
 void render_color_buffer(void);
 void destroy_window(void);
-void clear_color_buffer(uint32_t color);
+void clear_color_buffer(const uint32_t* background);
 void clear_z_buffer(void);
+void invalidate_color_buffer(void);
+void mark_dirty_rect(int min_x, int min_y, int max_x, int max_y);
+void mark_triangle_dirty(const triangle_t* triangle);
+int get_dirty_tiles_x(void);
+int get_dirty_tiles_y(void);
+float get_depth_scale(void);
+float get_depth_far(void);
+float encode_depth(float reciprocal_w);
 int place_in_buffer(int x, int y);
 void draw_pixel(int x, int y, uint32_t color);
 void draw_line(int x0, int y0, int x1, int y1, uint32_t color);
@@ -57,6 +91,9 @@ void draw_wireframe(triangle_t triangle, uint32_t color);
 void draw_vertex_points(triangle_t triangle, uint32_t color);
 float get_zbuffer_at(int x, int y);
 void update_zbuffer_at(int x, int y, float value);
+int get_hiz_width(void);
+int get_hiz_height(void);
+void update_hiz_block(int block_x, int block_y);
 
 bool should_render_solid(void);
 bool should_render_texture(void);
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "display.h"
+#include "layers.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Static layers
+///////////////////////////////////////////////////////////////////////////////
+// Content that does not change from one frame to the next is drawn once into
+// a window sized cache, and drawn again only when the window size changes or
+// a layer is added or invalidated:
+//
+//   background  the clear color and every LAYER_BACKGROUND layer. The frame
+//               starts by copying it into the tiles drawn to last frame.
+//   overlay     every LAYER_OVERLAY layer over a transparent buffer. Only the
+//               rectangle holding its opaque pixels is composited over each
+//               frame, after the geometry.
+///////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    int kind;
+    layer_draw_t draw;
+} layer_t;
+
+static layer_t layers[MAX_LAYERS];
+static int num_layers = 0;
+
+static uint32_t background_color = 0xFF000000;
+static uint32_t* background = NULL;
+static uint32_t* overlay = NULL;
+static int cache_width = 0;
+static int cache_height = 0;
+static bool cache_valid = false;
+
+// Bounds (inclusive) of the opaque pixels of the overlay, empty when min_x > max_x
+static int overlay_min_x, overlay_min_y, overlay_max_x, overlay_max_y;
+
+void set_background_color(uint32_t color) {
+    if (color != background_color) {
+        background_color = color;
+        cache_valid = false;
+    }
+}
+
+bool add_layer(int kind, layer_draw_t draw) {
+    if (num_layers == MAX_LAYERS) {
+        fprintf(stderr, "Cannot add more than %d layers\n", MAX_LAYERS);
+        return false;
+    }
+    layers[num_layers].kind = kind;
+    layers[num_layers].draw = draw;
+    num_layers++;
+    cache_valid = false;
+    return true;
+}
+
+// Redraw the layers before the next frame, after their content changed
+void invalidate_layers(void) {
+    cache_valid = false;
+}
+
+// Fill the cache and draw every layer of a kind into it, in the order they were added
+static void draw_layers(int kind, uint32_t* cache, uint32_t fill) {
+    for (int i = 0; i < cache_width * cache_height; i++) {
+        cache[i] = fill;
+    }
+    uint32_t* frame = color_buffer;
+    color_buffer = cache;
+    for (int i = 0; i < num_layers; i++) {
+        if (layers[i].kind == kind) {
+            layers[i].draw();
+        }
+    }
+    color_buffer = frame;
+}
+
+static void build_layers(void) {
+    int window_width = get_window_width();
+    int window_height = get_window_height();
+    if (window_width != cache_width || window_height != cache_height) {
+        free(background);
+        free(overlay);
+        background = (uint32_t*)malloc(sizeof(uint32_t) * window_width * window_height);
+        overlay = (uint32_t*)malloc(sizeof(uint32_t) * window_width * window_height);
+        if (!background || !overlay) {
+            fprintf(stderr, "Cannot allocate the layer caches\n");
+            exit(EXIT_FAILURE);
+        }
+        cache_width = window_width;
+        cache_height = window_height;
+    }
+
+    draw_layers(LAYER_BACKGROUND, background, background_color);
+    draw_layers(LAYER_OVERLAY, overlay, 0);
+
+    overlay_min_x = cache_width;
+    overlay_min_y = cache_height;
+    overlay_max_x = -1;
+    overlay_max_y = -1;
+    for (int y = 0; y < cache_height; y++) {
+        for (int x = 0; x < cache_width; x++) {
+            if (overlay[cache_width * y + x] >> 24) {
+                if (x < overlay_min_x) overlay_min_x = x;
+                if (x > overlay_max_x) overlay_max_x = x;
+                if (y < overlay_min_y) overlay_min_y = y;
+                overlay_max_y = y;
+            }
+        }
+    }
+
+    // Every tile of the color buffer shows the old background
+    invalidate_color_buffer();
+    cache_valid = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Start the frame from the background, rebuilding the caches first if the
+// window changed size or a layer changed
+///////////////////////////////////////////////////////////////////////////////
+void clear_to_background(void) {
+    if (!cache_valid || get_window_width() != cache_width || get_window_height() != cache_height) {
+        build_layers();
+    }
+    clear_color_buffer(background);
+}
+
+void draw_overlay_layers(void) {
+    if (overlay_min_x > overlay_max_x) {
+        return;
+    }
+    for (int y = overlay_min_y; y <= overlay_max_y; y++) {
+        const uint32_t* overlay_row = &overlay[cache_width * y];
+        uint32_t* color_row = &color_buffer[cache_width * y];
+        for (int x = overlay_min_x; x <= overlay_max_x; x++) {
+            if (overlay_row[x] >> 24) {
+                color_row[x] = overlay_row[x];
+            }
+        }
+    }
+    mark_dirty_rect(overlay_min_x, overlay_min_y, overlay_max_x, overlay_max_y);
+}
+
+void free_layers(void) {
+    free(background);
+    free(overlay);
+    background = NULL;
+    overlay = NULL;
+    cache_width = 0;
+    cache_height = 0;
+    cache_valid = false;
+}
@@ -0,0 +1,26 @@
+#ifndef LAYERS_H
+#define LAYERS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MAX_LAYERS 8
+
+// Draws the content of a static layer with the usual display functions
+// (draw_pixel, draw_line, draw_rect, ...), which write to the layer's cache
+// while it is built
+typedef void (*layer_draw_t)(void);
+
+enum layer_kinds {
+    LAYER_BACKGROUND,  // under the geometry, e.g. the grid
+    LAYER_OVERLAY      // over the geometry, e.g. a HUD; pixels left at zero alpha are transparent
+};
+
+void set_background_color(uint32_t color);
+bool add_layer(int kind, layer_draw_t draw);
+void invalidate_layers(void);
+void clear_to_background(void);
+void draw_overlay_layers(void);
+void free_layers(void);
+
+#endif
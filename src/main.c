@@ -1,18 +1,28 @@
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
 
 #include <SDL2/SDL.h>
 
+#include "arena.h"
 #include "array.h"
 #include "camera.h"
 #include "color.h"
 #include "clipping.h"
 #include "display.h"
+#include "layers.h"
 #include "light.h"
 #include "matrix.h"
 #include "mesh.h"
+#include "meshlet.h"
+#include "rasterizer.h"
+#include "scene.h"
+#include "simplify.h"
+#include "stats.h"
 #include "texture.h"
+#include "tiles.h"
 #include "triangle.h"
 #include "vector.h"
 #include "upng.h"
@@ -27,14 +37,30 @@ static const char *const usages[] = {
 
 char *mesh_filename = "./assets/drone.obj";
 char *texture_filename = "./assets/drone.png";
-
-// Array of triangles to render frame by frame
+char *scene_filename = NULL;
+int num_raster_threads = 0;
+int no_mesh_cache = 0;
+int verify_mesh_cache = 0;
+int no_mesh_optimize = 0;
+
+// Transient memory of the frame: the triangles to render, the tile bins and the
+// sort and shading scratch. It is reset at the start of every frame.
+#define FRAME_ARENA_SIZE (4 * 1024 * 1024)
+arena_t frame_arena;
+
+// Array of triangles to render frame by frame, in the frame arena
 // pointer in memory to the first position of array
-#define MAX_TRIANGLES 10000
-triangle_t triangles_to_render[MAX_TRIANGLES];
+triangle_t* triangles_to_render = NULL;
 int num_triangles_to_render = 0;
+int triangles_to_render_capacity = 0;
+
+// Clip space position of every vertex of the current object, filled by the vertex stage.
+// Sized for the largest mesh of the scene, and reused by one object after the other.
+vec4_soa_t clip_vertices;
+
+// Frustum outcode of every vertex of the current object, see compute_outcodes()
+uint16_t* vertex_outcodes = NULL;
 
-mat4_t world_matrix;
 mat4_t projection_matrix;
 mat4_t view_matrix;
 
@@ -42,6 +68,10 @@ bool is_running = false;
 int previous_frame_time = 0;
 float delta_time = 0;
 
+static void draw_grid_layer(void) {
+    draw_grid_as_lines(50);
+}
+
 bool setup(void) {
     int window_width = get_window_width();
     int window_height = get_window_height();
@@ -59,9 +89,42 @@ bool setup(void) {
 
     // Initialize frustum planes with a point and a normal
     init_frustum_planes(fov_x, fov_y, z_near, z_far);
+
+    // The grid never changes: it is drawn once into the background layer
+    set_background_color(0xFF000000);
+    add_layer(LAYER_BACKGROUND, draw_grid_layer);
     
-    load_obj_file_data(mesh_filename);
-    load_png_texture_data(texture_filename);
+    set_mesh_cache(!no_mesh_cache);
+    set_mesh_cache_verify(verify_mesh_cache);
+    set_mesh_optimization(!no_mesh_optimize);
+
+    // Without a scene file, show the single object of the command line spinning in front of the camera
+    if (scene_filename) {
+        if (!load_scene_file(scene_filename)) {
+            return false;
+        }
+    } else if (!add_instance(mesh_filename, texture_filename, vec3_new(0, 0, 5), 1.0, vec3_new(0.2, 0.2, 0.2))) {
+        return false;
+    }
+    printf("Scene of %d objects\n", get_num_instances());
+
+    if (!arena_init(&frame_arena, FRAME_ARENA_SIZE)) {
+        fprintf(stderr, "Cannot allocate the frame arena\n");
+        return false;
+    }
+
+    int max_vertices = get_scene_max_vertices();
+    clip_vertices = vec4_soa_new(max_vertices);
+    vertex_outcodes = (uint16_t*)malloc(sizeof(uint16_t) * (max_vertices ? max_vertices : 1));
+    if (clip_vertices.count != max_vertices || vertex_outcodes == NULL) {
+        fprintf(stderr, "Cannot allocate the transformed vertices\n");
+        return false;
+    }
+
+    if (!init_tiles(num_raster_threads)) {
+        return false;
+    }
+    printf("Rasterizing with %d threads\n", get_tile_threads());
     return true;
 }
 
@@ -103,6 +166,30 @@ void process_input(void) {
                     case SDLK_x:
                         set_cull_method(CULL_NONE);
                         break;
+                    case SDLK_r:
+                        set_raster_method((get_raster_method() + 1) % NUM_RASTER_MODES);
+                        break;
+                    case SDLK_t:
+                        set_tiled_rendering(!get_tiled_rendering());
+                        break;
+                    case SDLK_z:
+                        set_hiz_culling(!get_hiz_culling());
+                        break;
+                    case SDLK_v:
+                        set_deferred_texturing(!get_deferred_texturing());
+                        break;
+                    case SDLK_f:
+                        set_depth_sorting(!get_depth_sorting());
+                        break;
+                    case SDLK_p:
+                        set_print_stats(!get_print_stats());
+                        break;
+                    case SDLK_l:
+                        set_lod_selection(!get_lod_selection());
+                        break;
+                    case SDLK_g:
+                        set_guard_band_clipping(!get_guard_band_clipping());
+                        break;
                     case SDLK_UP:
                         update_camera_forward_velocity(vec3_mul(get_camera_direction(), 5.0 * delta_time));
                         update_camera_position(vec3_add(get_camera_position(), get_camera_forward_velocity()));
@@ -130,211 +217,330 @@ void process_input(void) {
 }
 
 
-void update(void) {
-    // Wait some time until the reach the target frame time in milliseconds
-    int time_to_wait = FRAME_TARGET_TIME - (SDL_GetTicks() - previous_frame_time);
+///////////////////////////////////////////////////////////////////////////////
+// Append a triangle to the triangles to render. The array is the last
+// allocation of the frame arena while the geometry stage runs, so doubling
+// it extends it in place.
+///////////////////////////////////////////////////////////////////////////////
+static void push_triangle(triangle_t triangle) {
+    if (num_triangles_to_render == triangles_to_render_capacity) {
+        int capacity = triangles_to_render_capacity ? triangles_to_render_capacity * 2 : 1024;
+        triangles_to_render = (triangle_t*)arena_grow(
+            &frame_arena, triangles_to_render,
+            sizeof(triangle_t) * triangles_to_render_capacity, sizeof(triangle_t) * capacity
+        );
+        triangles_to_render_capacity = capacity;
+    }
+    triangles_to_render[num_triangles_to_render++] = triangle;
+}
 
-    // Only delay execution if we are running too fast
-    if (time_to_wait > 0 && time_to_wait <= FRAME_TARGET_TIME) {
-        SDL_Delay(time_to_wait);
+///////////////////////////////////////////////////////////////////////////////
+// Transform the vertices of one object of the scene to clip space, then
+// cull its meshlets and add the visible faces, clipped and projected, to the
+// triangles of the frame. Counts the meshlets of the object and the culled ones.
+// An object outside the frustum is skipped before its vertices are touched,
+// and the faces of an object inside it are never clipped.
+///////////////////////////////////////////////////////////////////////////////
+static void process_instance(const instance_t* instance, int* scene_meshlets, int* scene_culled_meshlets) {
+    const mesh_t* mesh = instance->mesh;
+
+    // The model-view matrix takes the mesh to camera space for the bounds tests,
+    // and the model-view-projection matrix takes the vertices straight to clip space
+    mat4_t world_matrix = instance_world_matrix(instance);
+    mat4_t model_view_matrix = mat4_mul_mat4(view_matrix, world_matrix);
+    mat4_t mvp_matrix = mat4_mul_mat4(projection_matrix, model_view_matrix);
+
+    // Object stage: test the bounds of the mesh against the six frustum planes
+    frustum_test_t object_test = instance_frustum_test(instance, &model_view_matrix);
+    add_object_stats(1, object_test == FRUSTUM_OUTSIDE, object_test == FRUSTUM_INSIDE);
+    if (object_test == FRUSTUM_OUTSIDE) {
+        return;
     }
 
-    // Get a delta time factor converted to seconds to be used to update our game objects
-    delta_time = (SDL_GetTicks() - previous_frame_time) / 1000.0;
+    // Vertex stage: transform every vertex of the mesh once, faces share the results
+    mat4_mul_vec3_soa(&mvp_matrix, &mesh->positions, &clip_vertices);
 
-    previous_frame_time = SDL_GetTicks();
+    // Unless the whole object is inside the frustum, flag where each vertex is relative to the clip planes
+    if (object_test != FRUSTUM_INSIDE) {
+        compute_outcodes(&clip_vertices, mesh->positions.count, vertex_outcodes);
+    }
 
-    // Initialize the counter of triangles to render for the current frame
-    num_triangles_to_render = 0;
+    // The meshlet tests scale the bounding spheres by the largest scale factor, and
+    // the normal cones only hold while the scale keeps the shape and the winding
+    float max_scale = instance_max_scale(instance);
+    bool uniform_scale = instance->scale.x == instance->scale.y && instance->scale.y == instance->scale.z && instance->scale.x > 0;
+    bool cull_backfaces = get_cull_method() == CULL_BACKFACE;
+
+    // Faces are culled and lit from their model space normals. The cofactor matrix takes
+    // a normal to camera space, and eye is the camera position in model space times
+    // the determinant, so dot(normal, eye - det * A) is the camera space backface test
+    mat4_t normal_matrix = mat4_cofactor3(model_view_matrix);
+    float det = mat4_det3(model_view_matrix);
+    vec3_t translation = { model_view_matrix.m[0][3], model_view_matrix.m[1][3], model_view_matrix.m[2][3] };
+    vec3_t eye = {
+        -(normal_matrix.m[0][0] * translation.x + normal_matrix.m[1][0] * translation.y + normal_matrix.m[2][0] * translation.z),
+        -(normal_matrix.m[0][1] * translation.x + normal_matrix.m[1][1] * translation.y + normal_matrix.m[2][1] * translation.z),
+        -(normal_matrix.m[0][2] * translation.x + normal_matrix.m[1][2] * translation.y + normal_matrix.m[2][2] * translation.z)
+    };
 
-    // Change the mesh scale, rotation, and translation values per animation frame
-    mesh.rotation.x += 0.2 * delta_time;
-    mesh.rotation.y += 0.2 * delta_time;
-    mesh.rotation.z += 0.2 * delta_time;
-    mesh.translation.z = 5.0;
+    // Pick the level of detail from the size of the bounding sphere on screen
+    vec3_t mesh_center = vec3_from_vec4(mat4_mul_vec4(model_view_matrix, vec4_from_vec3(mesh->bounds_center)));
+    float mesh_distance = vec3_length(mesh_center);
+    float mesh_radius = mesh->bounds_radius * max_scale;
+    int lod_index = 0;
+    if (mesh_distance > mesh_radius) {
+        float projected_radius = mesh_radius / mesh_distance * projection_matrix.m[1][1] * (get_window_height() / 2.0);
+        lod_index = select_lod(mesh, projected_radius);
+    }
 
-    // Offset the camera position in the direction where the camera is pointing at
-    vec3_t target = get_camera_lookat_target();
-    vec3_t up_direction = { 0, 1, 0 };
-    
-    // Create the view matrix
-    view_matrix = mat4_look_at(get_camera_position(), target, up_direction);
+    // Loop all meshlets of the level, skipping the ones outside the frustum or facing away as a whole
+    int first_meshlet = array_length(mesh->lods) > 0 ? mesh->lods[lod_index].first_meshlet : 0;
+    int num_meshlets = array_length(mesh->lods) > 0 ? mesh->lods[lod_index].num_meshlets : 0;
+    *scene_meshlets += num_meshlets;
+    int num_faces = 0;
+    int num_rejected_faces = 0;
+    int num_clipped_faces = 0;
+    int clip_outcodes = get_clip_outcodes();
+    for (int m = first_meshlet; m < first_meshlet + num_meshlets; m++) {
+        meshlet_t* meshlet = &mesh->meshlets[m];
+        if (!meshlet_visible(meshlet, &model_view_matrix, max_scale, cull_backfaces && uniform_scale)) {
+            (*scene_culled_meshlets)++;
+            continue;
+        }
 
-    // Create scale, rotation, and translation matrices that will be used to multiply the mesh vertices
-    mat4_t scale_matrix = mat4_make_scale(mesh.scale.x, mesh.scale.y, mesh.scale.z);
-    mat4_t translation_matrix = mat4_make_translation(mesh.translation.x, mesh.translation.y, mesh.translation.z);
-    mat4_t rotation_matrix_x = mat4_make_rotation_x(mesh.rotation.x);
-    mat4_t rotation_matrix_y = mat4_make_rotation_y(mesh.rotation.y);
-    mat4_t rotation_matrix_z = mat4_make_rotation_z(mesh.rotation.z);
+        // Loop all triangles of the meshlet
+        int end = meshlet->first_triangle + meshlet->num_triangles;
+        for (int i = meshlet->first_triangle; i < end; i++) {
+            int face_indices[3] = {
+                mesh_index(mesh, i * 3 + 0),
+                mesh_index(mesh, i * 3 + 1),
+                mesh_index(mesh, i * 3 + 2)
+            };
+            num_faces++;
+
+            // Trivial reject: all three vertices are behind the same frustum plane
+            int planes_to_clip = 0;
+            if (object_test != FRUSTUM_INSIDE) {
+                int a = vertex_outcodes[face_indices[0]];
+                int b = vertex_outcodes[face_indices[1]];
+                int c = vertex_outcodes[face_indices[2]];
+                if (a & b & c & OUTCODE_FRUSTUM) {
+                    num_rejected_faces++;
+                    continue;
+                }
+                planes_to_clip = (a | b | c) & clip_outcodes;
+            }
 
-    // Loop all triangle faces of our mesh
-    int num_faces = array_length(mesh.faces);
-    for (int i = 0; i < num_faces; i++) {
-        face_t mesh_face = mesh.faces[i];
+            // Face stage: compute the normal from the model space vertices
+            vec3_t vector_a = mesh->vertices[face_indices[0]]; /*   A   */
+            vec3_t vector_b = mesh->vertices[face_indices[1]]; /*  / \  */
+            vec3_t vector_c = mesh->vertices[face_indices[2]]; /* C---B */
+            vec3_t normal = vec3_cross(vec3_sub(vector_b, vector_a), vec3_sub(vector_c, vector_a));
 
-        vec3_t face_vertices[3];
-        face_vertices[0] = mesh.vertices[mesh_face.a];
-        face_vertices[1] = mesh.vertices[mesh_face.b];
-        face_vertices[2] = mesh.vertices[mesh_face.c];
+            // Backface culling, bypassing triangles that are looking away from the camera
+            if (cull_backfaces) {
+                vec3_t camera_ray = vec3_sub(eye, vec3_mul(vector_a, det));
+                if (vec3_dot(normal, camera_ray) < 0) {
+                    continue;
+                }
+            }
 
-        vec4_t transformed_vertices[3];
+            // Fetch the clip space vertices of the face with their texture coordinates
+            clip_vertex_t face_vertices[3];
+            for (int j = 0; j < 3; j++) {
+                face_vertices[j].position = vec4_soa_get(&clip_vertices, face_indices[j]);
+                face_vertices[j].texcoord = mesh->texcoords[face_indices[j]];
+            }
 
-        // Loop all three vertices of this current face and apply transformations
-        for (int j = 0; j < 3; j++) {
-            vec4_t transformed_vertex = vec4_from_vec3(face_vertices[j]);
+            triangle_t triangles_after_clipping[MAX_NUM_POLY_TRIANGLES];
+            int num_triangles_after_clipping = 0;
 
-            // Create a World Matrix combining scale, rotation, and translation matrices
-            world_matrix = mat4_identity();
+            if (planes_to_clip == 0) {
+                // Trivial accept: clipping would not change the face, the rasterizers scissor what is off screen
+                for (int j = 0; j < 3; j++) {
+                    triangles_after_clipping[0].points[j] = face_vertices[j].position;
+                    triangles_after_clipping[0].texcoords[j] = face_vertices[j].texcoord;
+                }
+                num_triangles_after_clipping = 1;
+            } else {
+                num_clipped_faces++;
 
-            // Order matters: First scale, then rotate, then translate. [T]*[R]*[S]*v
-            world_matrix = mat4_mul_mat4(scale_matrix, world_matrix);
-            world_matrix = mat4_mul_mat4(rotation_matrix_z, world_matrix);
-            world_matrix = mat4_mul_mat4(rotation_matrix_y, world_matrix);
-            world_matrix = mat4_mul_mat4(rotation_matrix_x, world_matrix);
-            world_matrix = mat4_mul_mat4(translation_matrix, world_matrix);
+                // Create a polygon from the clip space triangle, new vertices get interpolated texture coordinates
+                polygon_t polygon = polygon_from_triangle(face_vertices[0], face_vertices[1], face_vertices[2]);
 
-            // Multiply the world matrix by the original vector
-            transformed_vertex = mat4_mul_vec4(world_matrix, transformed_vertex);
+                // Clip the polygon and returns a new polygon with potential new vertices
+                clip_polygon(&polygon, planes_to_clip);
 
-            // Multiply the view matrix by the vector to transform the scene to camera space
-            transformed_vertex = mat4_mul_vec4(view_matrix, transformed_vertex);
+                // Break the clipped polygon apart back into individual triangles
+                triangles_from_polygon(&polygon, triangles_after_clipping, &num_triangles_after_clipping);
+            }
 
-            // Save transformed vertex in the array of transformed vertices
-            transformed_vertices[j] = transformed_vertex;
-        }
+            // Take the normal to camera space for lighting
+            vec4_t normal4 = vec4_from_vec3(normal);
+            normal4.w = 0;
+            normal = vec3_from_vec4(mat4_mul_vec4(normal_matrix, normal4));
+            vec3_normalize(&normal);
 
-        // Get individual vectors from A, B, and C vertices to compute normal
-        vec3_t vector_a = vec3_from_vec4(transformed_vertices[0]); /*   A   */
-        vec3_t vector_b = vec3_from_vec4(transformed_vertices[1]); /*  / \  */
-        vec3_t vector_c = vec3_from_vec4(transformed_vertices[2]); /* C---B */
+            // Loops all the assembled triangles after clipping
+            for (int t = 0; t < num_triangles_after_clipping; t++) {
+                triangle_t triangle_after_clipping = triangles_after_clipping[t];
 
-        // Get the vector subtraction of B-A and C-A
-        vec3_t vector_ab = vec3_sub(vector_b, vector_a);
-        vec3_t vector_ac = vec3_sub(vector_c, vector_a);
-        vec3_normalize(&vector_ab);
-        vec3_normalize(&vector_ac);
+                vec4_t projected_points[3];
 
-        // Compute the face normal (using cross product to find perpendicular)
-        vec3_t normal = vec3_cross(vector_ab, vector_ac);
-        vec3_normalize(&normal);
+                // Loop all three vertices to perform conversion to screen space
+                for (int j = 0; j < 3; j++) {
+                    // The vertices are already projected to clip space
+                    projected_points[j] = triangle_after_clipping.points[j];
 
-        // Find the vector between vertex A in the triangle and the camera origin
-        vec3_t origin = { 0, 0, 0 };
-        vec3_t camera_ray = vec3_sub(origin, vector_a);
+                    // Perform perspective divide
+                    if (projected_points[j].w != 0) {
+                        projected_points[j].x /= projected_points[j].w;
+                        projected_points[j].y /= projected_points[j].w;
+                        projected_points[j].z /= projected_points[j].w;
+                    }
 
-        // Calculate how aligned the camera ray is with the face normal (using dot product)
-        float dot_normal_camera = vec3_dot(normal, camera_ray);
+                    // Flip vertically since the y values of the 3D mesh grow bottom->up and in screen space y values grow top->down
+                    projected_points[j].y *= -1;
 
-        // Backface culling test to see if the current face should be projected
-        if (cull_method == CULL_BACKFACE) {
-            // Backface culling, bypassing triangles that are looking away from the camera
-            if (dot_normal_camera < 0) {
-                continue;
+                    // Scale into the view
+                    projected_points[j].x *= (get_window_width() / 2.0);
+                    projected_points[j].y *= (get_window_height() / 2.0);
+
+                    // Translate the projected points to the middle of the screen
+                    projected_points[j].x += (get_window_width() / 2.0);
+                    projected_points[j].y += (get_window_height() / 2.0);
+                }
+
+                // Calculate the shade intensity based on how aliged is the normal with the flipped light direction ray
+                float light_intensity_factor = -vec3_dot(normal, get_light_direction());
+
+                // Calculate the triangle color based on the light angle
+                uint32_t triangle_color = light_apply_intensity(mesh->color, light_intensity_factor);
+
+                // Create the final projected triangle that will be rendered in screen space
+                triangle_t triangle_to_render = {
+                    .points = {
+                        { projected_points[0].x, projected_points[0].y, projected_points[0].z, projected_points[0].w },
+                        { projected_points[1].x, projected_points[1].y, projected_points[1].z, projected_points[1].w },
+                        { projected_points[2].x, projected_points[2].y, projected_points[2].z, projected_points[2].w },
+                    },
+                    .texcoords = {
+                        triangle_after_clipping.texcoords[0],
+                        triangle_after_clipping.texcoords[1],
+                        triangle_after_clipping.texcoords[2]
+                    },
+                    .color = triangle_color,
+                    .texture = instance->texture
+                };
+
+                // Save the projected triangle in the array of triangles to render
+                push_triangle(triangle_to_render);
             }
         }
-        
-        // Create a polygon from the original transformed triangle to be clipped
-        polygon_t polygon = polygon_from_triangle(
-            vec3_from_vec4(transformed_vertices[0]),
-            vec3_from_vec4(transformed_vertices[1]),
-            vec3_from_vec4(transformed_vertices[2])
-        );
-        
-        // Clip the polygon and returns a new polygon with potential new vertices
-        clip_polygon(&polygon);
+    }
+    add_clip_stats(num_faces, num_rejected_faces, num_clipped_faces);
+}
 
-        // Break the clipped polygon apart back into individual triangles
-        triangle_t triangles_after_clipping[MAX_NUM_POLY_TRIANGLES];
-        int num_triangles_after_clipping = 0;
 
-        triangles_from_polygon(&polygon, triangles_after_clipping, &num_triangles_after_clipping);
+void update(void) {
+    // Wait some time until the reach the target frame time in milliseconds
+    int time_to_wait = FRAME_TARGET_TIME - (SDL_GetTicks() - previous_frame_time);
 
-        // Loops all the assembled triangles after clipping
-        for (int t = 0; t < num_triangles_after_clipping; t++) {
-            triangle_t triangle_after_clipping = triangles_after_clipping[t];
+    // Only delay execution if we are running too fast
+    if (time_to_wait > 0 && time_to_wait <= FRAME_TARGET_TIME) {
+        SDL_Delay(time_to_wait);
+    }
 
-            vec4_t projected_points[3];
+    // Get a delta time factor converted to seconds to be used to update our game objects
+    delta_time = (SDL_GetTicks() - previous_frame_time) / 1000.0;
 
-            // Loop all three vertices to perform projection and conversion to screen space
-            for (int j = 0; j < 3; j++) {
-                // Project the current vertex using a perspective projection matrix
-                projected_points[j] = mat4_mul_vec4(projection_matrix, triangle_after_clipping.points[j]);
-
-                // Perform perspective divide
-                if (projected_points[j].w != 0) {
-                    projected_points[j].x /= projected_points[j].w;
-                    projected_points[j].y /= projected_points[j].w;
-                    projected_points[j].z /= projected_points[j].w;
-                }
+    previous_frame_time = SDL_GetTicks();
 
-                // Flip vertically since the y values of the 3D mesh grow bottom->up and in screen space y values grow top->down
-                projected_points[j].y *= -1;
+    // Release the memory of the last frame and start an empty array of triangles to render
+    arena_reset(&frame_arena);
+    triangles_to_render = NULL;
+    num_triangles_to_render = 0;
+    triangles_to_render_capacity = 0;
 
-                // Scale into the view
-                projected_points[j].x *= (get_window_width() / 2.0);
-                projected_points[j].y *= (get_window_height() / 2.0);
+    // The frame statistics cover the geometry stage of update() and the rasterization of render()
+    reset_frame_stats();
 
-                // Translate the projected points to the middle of the screen
-                projected_points[j].x += (get_window_width() / 2.0);
-                projected_points[j].y += (get_window_height() / 2.0);
-            }
+    // Advance the animation of every object
+    update_scene(delta_time);
 
-            // Calculate the shade intensity based on how aliged is the normal with the flipped light direction ray
-            float light_intensity_factor = -vec3_dot(normal, get_light_direction());
-
-            // Calculate the triangle color based on the light angle
-            uint32_t triangle_color = light_apply_intensity(mesh_face.color, light_intensity_factor);
-
-            // Create the final projected triangle that will be rendered in screen space
-            triangle_t triangle_to_render = {
-                .points = {
-                    { projected_points[0].x, projected_points[0].y, projected_points[0].z, projected_points[0].w },
-                    { projected_points[1].x, projected_points[1].y, projected_points[1].z, projected_points[1].w },
-                    { projected_points[2].x, projected_points[2].y, projected_points[2].z, projected_points[2].w },
-                },
-                .texcoords = {
-                    { mesh_face.a_uv.u, mesh_face.a_uv.v },
-                    { mesh_face.b_uv.u, mesh_face.b_uv.v },
-                    { mesh_face.c_uv.u, mesh_face.c_uv.v }
-                },
-                .color = triangle_color
-            };
+    // Offset the camera position in the direction where the camera is pointing at
+    vec3_t target = get_camera_lookat_target();
+    vec3_t up_direction = { 0, 1, 0 };
+    
+    // Create the view matrix
+    view_matrix = mat4_look_at(get_camera_position(), target, up_direction);
 
-            // Save the projected triangle in the array of triangles to render
-            if (num_triangles_to_render < MAX_TRIANGLES) {
-                triangles_to_render[num_triangles_to_render++] = triangle_to_render;
-            }
-        }
+    // Every object runs the same vertex, meshlet and face stages in turn
+    int num_meshlets = 0;
+    int num_culled_meshlets = 0;
+    for (int i = 0; i < get_num_instances(); i++) {
+        process_instance(get_instance(i), &num_meshlets, &num_culled_meshlets);
+    }
+    add_meshlet_stats(num_meshlets, num_culled_meshlets);
+
+    // Submit the nearest triangles first so the depth test rejects what is hidden behind them
+    if (get_depth_sorting()) {
+        sort_triangles_front_to_back(triangles_to_render, num_triangles_to_render, &frame_arena);
     }
 }
 
 
 void render(void) {
-    clear_color_buffer(0xFF000000);
+    clear_to_background();
     clear_z_buffer();
-    
-    draw_grid_as_lines(50);
+
+    // The half-space rasterizers can fill the triangles tile by tile on all the cores
+    bool render_fill_tiled = get_raster_method() != RASTER_SCANLINE && get_tiled_rendering();
+    if (render_fill_tiled && (should_render_solid() || should_render_texture())) {
+        render_tiles(
+            triangles_to_render, num_triangles_to_render, should_render_texture(), get_deferred_texturing(), &frame_arena
+        );
+    }
+
+    // Deferred texturing: store depth and triangle indices only, then texture every visible pixel once
+    bool render_deferred = get_raster_method() != RASTER_SCANLINE && get_deferred_texturing() && !render_fill_tiled;
+    if (render_deferred && should_render_texture()) {
+        for (int i = 0; i < num_triangles_to_render; i++) {
+            triangle_t triangle = triangles_to_render[i];
+            rasterize_visibility_triangle(&triangle, i, raster_screen_rect());
+        }
+        setup_visibility_triangles(triangles_to_render, num_triangles_to_render, &frame_arena);
+        resolve_visibility(raster_screen_rect());
+    }
     
     // loop projected points and render
     for (int i = 0; i < num_triangles_to_render; i++) {
         triangle_t triangle = triangles_to_render[i];
 
-        if (should_render_solid()) {
-            draw_filled_triangle(
-                triangle.points[0].x, triangle.points[0].y, triangle.points[0].z, triangle.points[0].w, 
-                triangle.points[1].x, triangle.points[1].y, triangle.points[1].z, triangle.points[2].w,
-                triangle.points[2].x, triangle.points[2].y, triangle.points[1].z, triangle.points[2].w,
-                triangle.color
-            );
+        if (should_render_solid() && !render_fill_tiled) {
+            if (get_raster_method() != RASTER_SCANLINE) {
+                rasterize_filled_triangle(&triangle, triangle.color, raster_screen_rect());
+            } else {
+                draw_filled_triangle(
+                    triangle.points[0].x, triangle.points[0].y, triangle.points[0].z, triangle.points[0].w, 
+                    triangle.points[1].x, triangle.points[1].y, triangle.points[1].z, triangle.points[2].w,
+                    triangle.points[2].x, triangle.points[2].y, triangle.points[1].z, triangle.points[2].w,
+                    triangle.color
+                );
+            }
         }
 
-        if (should_render_texture()) {
-            draw_textured_triangle(
-                triangle.points[0].x, triangle.points[0].y, triangle.points[0].z, triangle.points[0].w, triangle.texcoords[0].u, triangle.texcoords[0].v,
-                triangle.points[1].x, triangle.points[1].y, triangle.points[1].z, triangle.points[1].w, triangle.texcoords[1].u, triangle.texcoords[1].v,
-                triangle.points[2].x, triangle.points[2].y, triangle.points[2].z, triangle.points[2].w, triangle.texcoords[2].u, triangle.texcoords[2].v,
-                mesh_texture
-            );
+        if (should_render_texture() && !render_fill_tiled && !render_deferred) {
+            if (get_raster_method() != RASTER_SCANLINE) {
+                rasterize_textured_triangle(&triangle, raster_screen_rect());
+            } else {
+                draw_textured_triangle(
+                    triangle.points[0].x, triangle.points[0].y, triangle.points[0].z, triangle.points[0].w, triangle.texcoords[0].u, triangle.texcoords[0].v,
+                    triangle.points[1].x, triangle.points[1].y, triangle.points[1].z, triangle.points[1].w, triangle.texcoords[1].u, triangle.texcoords[1].v,
+                    triangle.points[2].x, triangle.points[2].y, triangle.points[2].z, triangle.points[2].w, triangle.texcoords[2].u, triangle.texcoords[2].v,
+                    triangle.texture
+                );
+            }
         }
 
         if (should_render_wireframe()) {
@@ -344,15 +550,24 @@ void render(void) {
         if (should_render_wire_vertex()) {
             draw_vertex_points(triangle, RED);
         }
+
+        // Next frame clears only the tiles this triangle may have drawn to
+        mark_triangle_dirty(&triangle);
     }
 
+    draw_overlay_layers();
     render_color_buffer();
+    set_arena_stats(frame_arena.frame_used, frame_arena.peak, frame_arena.capacity, frame_arena.num_block_allocations);
+    print_frame_stats();
 }
 
 void free_resources(void) {
-    array_free(mesh.faces);
-    array_free(mesh.vertices);
-    upng_free(png);
+    destroy_tiles();
+    vec4_soa_free(&clip_vertices);
+    free(vertex_outcodes);
+    arena_free(&frame_arena);
+    free_layers();
+    free_scene();
 }
 
 
@@ -365,6 +580,11 @@ int main(int argc, const char **argv) {
         OPT_GROUP("Basic options"),
         OPT_STRING('o', "obj", &mesh_filename, "Path to .OBJ model", NULL, 0, 0),
         OPT_STRING('t', "texture", &texture_filename, "Path to PNG texture", NULL, 0, 0),
+        OPT_STRING(0, "scene", &scene_filename, "Path to a scene file listing the objects to show, instead of -o and -t", NULL, 0, 0),
+        OPT_INTEGER('j', "threads", &num_raster_threads, "Rasterizer threads (0 = one per CPU)", NULL, 0, 0),
+        OPT_BOOLEAN(0, "no-mesh-cache", &no_mesh_cache, "Always parse the .OBJ file, without reading or writing its binary cache", NULL, 0, 0),
+        OPT_BOOLEAN(0, "verify-mesh-cache", &verify_mesh_cache, "Check the contents and checksums of the mesh caches on load, reading them whole", NULL, 0, 0),
+        OPT_BOOLEAN(0, "no-mesh-optimize", &no_mesh_optimize, "Keep the faces and vertices in the order of the .OBJ file", NULL, 0, 0),
         OPT_END(),
     };
 
@@ -374,9 +594,6 @@ int main(int argc, const char **argv) {
     argc = argparse_parse(&argparse, argc, argv);
 
 
-    printf("Loading %s\n", mesh_filename);
-    printf("Loading %s\n", texture_filename);
-
     if  (!setup()) {
         return 1;
     }
@@ -1,4 +1,9 @@
 #include <math.h>
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
 #include "matrix.h"
 
 mat4_t mat4_identity(void) {
@@ -93,6 +98,66 @@ vec4_t mat4_mul_vec4(mat4_t m, vec4_t v) {
     return result;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Transform a whole stream of points (w = 1) by the matrix in one call.
+// The matrix entries are broadcast once and every iteration transforms a
+// group of points straight from the aligned coordinate streams: 8 per
+// iteration with AVX, 4 with SSE, one at a time otherwise. The streams are
+// padded to SOA_ALIGNMENT, so the padding is transformed too and no scalar
+// tail is needed. The sums are done in the same order as mat4_mul_vec4, so
+// the results match it bit for bit. result must hold at least as many points
+// as points.
+///////////////////////////////////////////////////////////////////////////////
+void mat4_mul_vec3_soa(const mat4_t* m, const vec3_soa_t* points, vec4_soa_t* result) {
+    int i = 0;
+#if defined(__AVX__)
+    __m256 row[4][4];
+    for (int r = 0; r < 4; r++) {
+        for (int c = 0; c < 4; c++) {
+            row[r][c] = _mm256_set1_ps(m->m[r][c]);
+        }
+    }
+    float* out[4] = { result->x, result->y, result->z, result->w };
+    for (; i + 8 <= points->padded; i += 8) {
+        __m256 x = _mm256_load_ps(&points->x[i]);
+        __m256 y = _mm256_load_ps(&points->y[i]);
+        __m256 z = _mm256_load_ps(&points->z[i]);
+        for (int r = 0; r < 4; r++) {
+            __m256 value = _mm256_add_ps(_mm256_mul_ps(row[r][0], x), _mm256_mul_ps(row[r][1], y));
+            value = _mm256_add_ps(value, _mm256_mul_ps(row[r][2], z));
+            value = _mm256_add_ps(value, row[r][3]);
+            _mm256_store_ps(&out[r][i], value);
+        }
+    }
+#elif defined(__SSE__)
+    __m128 row[4][4];
+    for (int r = 0; r < 4; r++) {
+        for (int c = 0; c < 4; c++) {
+            row[r][c] = _mm_set1_ps(m->m[r][c]);
+        }
+    }
+    float* out[4] = { result->x, result->y, result->z, result->w };
+    for (; i + 4 <= points->padded; i += 4) {
+        __m128 x = _mm_load_ps(&points->x[i]);
+        __m128 y = _mm_load_ps(&points->y[i]);
+        __m128 z = _mm_load_ps(&points->z[i]);
+        for (int r = 0; r < 4; r++) {
+            __m128 value = _mm_add_ps(_mm_mul_ps(row[r][0], x), _mm_mul_ps(row[r][1], y));
+            value = _mm_add_ps(value, _mm_mul_ps(row[r][2], z));
+            value = _mm_add_ps(value, row[r][3]);
+            _mm_store_ps(&out[r][i], value);
+        }
+    }
+#endif
+    for (; i < points->count; i++) {
+        float x = points->x[i], y = points->y[i], z = points->z[i];
+        result->x[i] = m->m[0][0] * x + m->m[0][1] * y + m->m[0][2] * z + m->m[0][3];
+        result->y[i] = m->m[1][0] * x + m->m[1][1] * y + m->m[1][2] * z + m->m[1][3];
+        result->z[i] = m->m[2][0] * x + m->m[2][1] * y + m->m[2][2] * z + m->m[2][3];
+        result->w[i] = m->m[3][0] * x + m->m[3][1] * y + m->m[3][2] * z + m->m[3][3];
+    }
+}
+
 mat4_t mat4_mul_mat4(mat4_t a, mat4_t b) {
     mat4_t m;
     for (int i = 0; i < 4; i++) {
@@ -103,6 +168,39 @@ mat4_t mat4_mul_mat4(mat4_t a, mat4_t b) {
     return m;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Cofactor matrix of the upper 3x3 of m, with no translation. Its rows are
+// the cross products of the rows of m, so for any vectors a and b:
+//
+//   cross(m * a, m * b) = cofactor * cross(a, b)
+//
+// which takes face normals through m without inverting it, keeping their
+// orientation even when m mirrors or scales unevenly.
+///////////////////////////////////////////////////////////////////////////////
+mat4_t mat4_cofactor3(mat4_t m) {
+    vec3_t r0 = { m.m[0][0], m.m[0][1], m.m[0][2] };
+    vec3_t r1 = { m.m[1][0], m.m[1][1], m.m[1][2] };
+    vec3_t r2 = { m.m[2][0], m.m[2][1], m.m[2][2] };
+    vec3_t c0 = vec3_cross(r1, r2);
+    vec3_t c1 = vec3_cross(r2, r0);
+    vec3_t c2 = vec3_cross(r0, r1);
+    mat4_t c = {{
+        { c0.x, c0.y, c0.z, 0 },
+        { c1.x, c1.y, c1.z, 0 },
+        { c2.x, c2.y, c2.z, 0 },
+        {    0,    0,    0, 1 }
+    }};
+    return c;
+}
+
+// Determinant of the upper 3x3 of m
+float mat4_det3(mat4_t m) {
+    vec3_t r0 = { m.m[0][0], m.m[0][1], m.m[0][2] };
+    vec3_t r1 = { m.m[1][0], m.m[1][1], m.m[1][2] };
+    vec3_t r2 = { m.m[2][0], m.m[2][1], m.m[2][2] };
+    return vec3_dot(r0, vec3_cross(r1, r2));
+}
+
 mat4_t mat4_make_perspective(float fov, float aspect, float znear, float zfar) {
     // | (h/w)*1/tan(fov/2)             0              0                 0 |
     // |                  0  1/tan(fov/2)              0                 0 |
@@ -16,7 +16,10 @@ mat4_t mat4_make_rotation_x(float angle);
 mat4_t mat4_make_rotation_y(float angle);
 
 vec4_t mat4_mul_vec4(mat4_t m, vec4_t v);
+void mat4_mul_vec3_soa(const mat4_t* m, const vec3_soa_t* points, vec4_soa_t* result);
 mat4_t mat4_mul_mat4(mat4_t a, mat4_t b);
+mat4_t mat4_cofactor3(mat4_t m);
+float mat4_det3(mat4_t m);
 
 mat4_t mat4_make_perspective(float fov, float aspect, float znear, float zfar);
 mat4_t mat4_look_at(vec3_t eye, vec3_t target, vec3_t up);
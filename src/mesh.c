@@ -1,67 +1,327 @@
+#define _POSIX_C_SOURCE 200809L
+#include <math.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "array.h"
 #include "mesh.h"
+#include "mesh_cache.h"
+#include "mesh_optimize.h"
+#include "meshlet.h"
+#include "simplify.h"
+#include "obj_loader.h"
 
-mesh_t mesh = {
-    .vertices = NULL,
-    .faces = NULL,
-    .rotation = { 0, 0, 0 },
-    .scale = { 1.0, 1.0, 1.0 },
-    .translation = { 0, 0, 0 }
-};
+// Every mesh loaded so far, looked up by file name
+static mesh_t** meshes = NULL;
 
+static bool mesh_cache = true;
+static bool mesh_cache_verify = false;
+static bool mesh_optimization = true;
 
-void load_obj_file_data(char* filename) {
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
-        fprintf(stderr, "Cannot read asset\n");
-        return;
+bool get_mesh_cache(void) {
+    return mesh_cache;
+}
+
+void set_mesh_cache(bool enabled) {
+    mesh_cache = enabled;
+}
+
+bool get_mesh_cache_verify(void) {
+    return mesh_cache_verify;
+}
+
+void set_mesh_cache_verify(bool enabled) {
+    mesh_cache_verify = enabled;
+}
+
+bool get_mesh_optimization(void) {
+    return mesh_optimization;
+}
+
+void set_mesh_optimization(bool enabled) {
+    mesh_optimization = enabled;
+}
+
+int mesh_num_triangles(const mesh_t* m) {
+    return array_length(m->indices) / 3;
+}
+
+// Smallest power of two that is at least twice count, for half-empty hash tables
+static size_t hash_table_size(size_t count) {
+    size_t size = 16;
+    while (size < count * 2) {
+        size *= 2;
+    }
+    return size;
+}
+
+static uint32_t hash_words(const uint32_t* words, int count) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < count; i++) {
+        hash = (hash ^ words[i]) * 16777619u;
+        hash ^= hash >> 15;
+    }
+    return hash;
+}
+
+// The bits of a vertex, with -0.0 turned into 0.0 so both weld together
+static void vertex_key(vec3_t position, tex2_t uv, uint32_t key[5]) {
+    float values[5] = { position.x, position.y, position.z, uv.u, uv.v };
+    for (int i = 0; i < 5; i++) {
+        float value = values[i] == 0 ? 0.0f : values[i];
+        memcpy(&key[i], &value, sizeof(uint32_t));
+    }
+}
+
+static bool degenerate_triangle(vec3_t* vertices, uint32_t a, uint32_t b, uint32_t c) {
+    if (a == b || b == c || a == c) {
+        return true;
+    }
+    vec3_t normal = vec3_cross(vec3_sub(vertices[b], vertices[a]), vec3_sub(vertices[c], vertices[a]));
+    return normal.x == 0 && normal.y == 0 && normal.z == 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Build the indexed mesh from the triangles of the file. Corners with the
+// same position and UV (compared bit for bit) become one vertex, found with
+// an open-addressing hash table. Triangles that reuse an index or have no
+// area are dropped, and so are repeats of a triangle already kept: the same
+// three vertices in the same winding, starting from any corner. Returns
+// false if the mesh has more indices than MESH_MAX_INDICES.
+///////////////////////////////////////////////////////////////////////////////
+static bool build_indexed_mesh(obj_data_t* obj, mesh_t* m) {
+    size_t num_faces = array_length(obj->faces);
+    size_t num_corners = num_faces * 3;
+    if (num_corners > MESH_MAX_INDICES) {
+        fprintf(stderr, "Mesh of %zu triangles is too large, the limit is %d\n", num_faces, MESH_MAX_INDICES / 3);
+        return false;
     }
-    char buffer[1024];
 
+    // There are usually about as many welded vertices as positions in the file, so start with room for that many
+    vec3_t* vertices = NULL;
     tex2_t* texcoords = NULL;
+    array_reserve(vertices, array_length(obj->vertices));
+    array_reserve(texcoords, array_length(obj->vertices));
+    uint32_t* corner_indices = (uint32_t*)malloc(sizeof(uint32_t) * (num_corners ? num_corners : 1));
 
-    while (fgets(buffer, sizeof(buffer), file)) {
+    // Weld the corners: each hash table slot is empty (SIZE_MAX) or holds a vertex index
+    size_t table_size = hash_table_size(num_corners);
+    size_t* table = (size_t*)malloc(sizeof(size_t) * table_size);
+    memset(table, 0xFF, sizeof(size_t) * table_size);
+    for (size_t i = 0; i < num_corners; i++) {
+        face_t* face = &obj->faces[i / 3];
+        size_t corner = i % 3;
+        size_t position_index = corner == 0 ? face->a : (corner == 1 ? face->b : face->c);
+        tex2_t uv = corner == 0 ? face->a_uv : (corner == 1 ? face->b_uv : face->c_uv);
 
-        if (strncmp(buffer, "v ", 2) == 0) {
-            vec3_t vertex;
-            sscanf(buffer, "v %f %f %f", &vertex.x, &vertex.y, &vertex.z);
-            array_push(mesh.vertices, vertex);
+        uint32_t key[5];
+        vertex_key(obj->vertices[position_index], uv, key);
+        size_t slot = hash_words(key, 5) & (table_size - 1);
+        while (table[slot] != SIZE_MAX) {
+            uint32_t other[5];
+            vertex_key(vertices[table[slot]], texcoords[table[slot]], other);
+            if (memcmp(key, other, sizeof(key)) == 0) {
+                break;
+            }
+            slot = (slot + 1) & (table_size - 1);
         }
-        
-        if (strncmp(buffer, "vt ", 3) == 0) {
-            tex2_t texcoord;
-            sscanf(buffer, "vt %f %f", &texcoord.u, &texcoord.v);
-            array_push(texcoords, texcoord);
+        if (table[slot] == SIZE_MAX) {
+            table[slot] = array_length(vertices);
+            vec3_t position;
+            memcpy(&position, key, sizeof(position));
+            tex2_t welded_uv;
+            memcpy(&welded_uv, &key[3], sizeof(welded_uv));
+            array_push(vertices, position);
+            array_push(texcoords, welded_uv);
+        }
+        corner_indices[i] = (uint32_t)table[slot];
+    }
+
+    // Keep the valid triangles; the table now holds indices of kept triangles
+    size_t num_kept = 0;
+    memset(table, 0xFF, sizeof(size_t) * table_size);
+    for (size_t i = 0; i < num_faces; i++) {
+        uint32_t* t = &corner_indices[i * 3];
+        if (degenerate_triangle(vertices, t[0], t[1], t[2])) {
+            continue;
         }
 
-        if (strncmp(buffer, "f ", 2) == 0) {
-            // structure to store the f lines from the obj
-            int vertex_indices[3];
-            int texture_indices[3];
-            int normal_indices[3];
-            
-            sscanf(
-                buffer, 
-                "f %d/%d/%d %d/%d/%d %d/%d/%d",
-                &vertex_indices[0], &texture_indices[0], &normal_indices[0], 
-                &vertex_indices[1], &texture_indices[1], &normal_indices[1], 
-                &vertex_indices[2], &texture_indices[2], &normal_indices[2] 
-            );
-
-            face_t face = {
-                .a = vertex_indices[0] - 1,
-                .b = vertex_indices[1] - 1,
-                .c = vertex_indices[2] - 1,
-                .a_uv = texcoords[texture_indices[0] - 1],
-                .b_uv = texcoords[texture_indices[1] - 1],
-                .c_uv = texcoords[texture_indices[2] - 1],
-                .color = 0xFFFFFFFF
-            };
-
-            array_push(mesh.faces, face);
+        // Rotate the smallest index first, so every rotation of a triangle has the same key
+        int first = (t[0] < t[1] && t[0] < t[2]) ? 0 : (t[1] < t[2] ? 1 : 2);
+        uint32_t key[3] = { t[first], t[(first + 1) % 3], t[(first + 2) % 3] };
+        size_t slot = hash_words(key, 3) & (table_size - 1);
+        bool duplicate = false;
+        while (table[slot] != SIZE_MAX) {
+            if (memcmp(&corner_indices[table[slot] * 3], key, sizeof(key)) == 0) {
+                duplicate = true;
+                break;
+            }
+            slot = (slot + 1) & (table_size - 1);
+        }
+        if (duplicate) {
+            continue;
+        }
+        memcpy(&corner_indices[num_kept * 3], key, sizeof(key));
+        table[slot] = num_kept++;
+    }
+    free(table);
+
+    // Drop the vertices only used by dropped triangles, numbering the others in order of first use
+    size_t num_welded = array_length(vertices);
+    uint32_t* remap = (uint32_t*)malloc(sizeof(uint32_t) * (num_welded ? num_welded : 1));
+    memset(remap, 0xFF, sizeof(uint32_t) * num_welded);
+    uint32_t num_vertices = 0;
+    for (size_t i = 0; i < num_kept * 3; i++) {
+        if (remap[corner_indices[i]] == UINT32_MAX) {
+            remap[corner_indices[i]] = num_vertices++;
+        }
+    }
+    m->vertices = num_vertices ? array_hold(NULL, num_vertices, sizeof(vec3_t)) : NULL;
+    m->texcoords = num_vertices ? array_hold(NULL, num_vertices, sizeof(tex2_t)) : NULL;
+    for (size_t i = 0; i < num_welded; i++) {
+        if (remap[i] != UINT32_MAX) {
+            m->vertices[remap[i]] = vertices[i];
+            m->texcoords[remap[i]] = texcoords[i];
         }
     }
+    for (size_t i = 0; i < num_kept * 3; i++) {
+        corner_indices[i] = remap[corner_indices[i]];
+    }
+    free(remap);
+    array_free(vertices);
     array_free(texcoords);
+
+    m->index_size = num_vertices <= 65536 ? 2 : 4;
+    m->indices = num_kept ? array_hold(NULL, num_kept * 3, m->index_size) : NULL;
+    for (size_t i = 0; i < num_kept * 3; i++) {
+        if (m->index_size == 2) {
+            ((uint16_t*)m->indices)[i] = corner_indices[i];
+        } else {
+            ((uint32_t*)m->indices)[i] = corner_indices[i];
+        }
+    }
+    free(corner_indices);
+
+    printf(
+        "Welded %zu vertices into %u, kept %zu of %zu triangles, %d-bit indices\n",
+        array_length(obj->vertices), num_vertices, num_kept, num_faces, m->index_size * 8
+    );
+    return true;
+}
+
+// Bounding box of the vertices, and a sphere around its center
+static void compute_mesh_bounds(mesh_t* m) {
+    size_t num_vertices = array_length(m->vertices);
+    if (num_vertices == 0) {
+        return;
+    }
+    vec3_t min = m->vertices[0];
+    vec3_t max = m->vertices[0];
+    for (size_t i = 1; i < num_vertices; i++) {
+        vec3_t v = m->vertices[i];
+        min.x = fminf(min.x, v.x); max.x = fmaxf(max.x, v.x);
+        min.y = fminf(min.y, v.y); max.y = fmaxf(max.y, v.y);
+        min.z = fminf(min.z, v.z); max.z = fmaxf(max.z, v.z);
+    }
+    m->bounds_min = min;
+    m->bounds_max = max;
+    m->bounds_center = vec3_mul(vec3_add(min, max), 0.5);
+    m->bounds_radius = 0;
+    for (size_t i = 0; i < num_vertices; i++) {
+        m->bounds_radius = fmaxf(m->bounds_radius, vec3_length(vec3_sub(m->vertices[i], m->bounds_center)));
+    }
+}
+
+// Fill the mesh from the cache of the file, or parse it and build everything
+static bool load_obj_file_data(char* filename, mesh_t* m) {
+    // A valid binary cache of this file replaces the whole parse
+    if (mesh_cache && load_mesh_cache(filename, m)) {
+        return true;
+    }
+
+    obj_data_t obj = { NULL, NULL };
+    if (!parse_obj_file(filename, &obj)) {
+        fprintf(stderr, "Cannot read asset %s\n", filename);
+        return false;
+    }
+    bool built = build_indexed_mesh(&obj, m);
+    array_free(obj.vertices);
+    array_free(obj.faces);
+    if (!built) {
+        return false;
+    }
+
+    if (mesh_optimization) {
+        optimize_mesh(m);
+    }
+    compute_mesh_bounds(m);
+    build_lod_chain(m);
+
+    // Every level gets its own meshlets, stored one level after the other
+    for (size_t i = 0; i < array_length(m->lods); i++) {
+        lod_t* lod = &m->lods[i];
+        lod->first_meshlet = array_length(m->meshlets);
+        m->meshlets = build_meshlets(m, lod->first_triangle, lod->num_triangles, m->meshlets);
+        lod->num_meshlets = array_length(m->meshlets) - lod->first_meshlet;
+    }
+
+    // The levels and their meshlets were appended one by one: give back the room left over by doubling
+    m->indices = array_shrink_items(m->indices, m->index_size);
+    array_shrink(m->meshlets);
+    array_shrink(m->lods);
+    m->positions = vec3_soa_from_vec3(m->vertices, array_length(m->vertices));
+
+    if (mesh_cache) {
+        save_mesh_cache(filename, m);
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Return the mesh of an .OBJ file, loading it on the first request only. Every
+// object that shows the same file shares its arrays. Returns NULL when the
+// file cannot be read.
+///////////////////////////////////////////////////////////////////////////////
+mesh_t* load_mesh(char* filename) {
+    for (size_t i = 0; i < array_length(meshes); i++) {
+        if (strcmp(meshes[i]->filename, filename) == 0) {
+            return meshes[i];
+        }
+    }
+
+    printf("Loading %s\n", filename);
+    mesh_t* m = (mesh_t*)calloc(1, sizeof(mesh_t));
+    m->index_size = 4;
+    m->color = 0xFFFFFFFF;
+    if (!load_obj_file_data(filename, m)) {
+        free(m);
+        return NULL;
+    }
+    m->filename = strdup(filename);
+    array_push(meshes, m);
+    return m;
+}
+
+static void free_mesh(mesh_t* m) {
+    if (m->mapped_file) {
+        unmap_mesh_cache(m);
+    } else {
+        array_free(m->lods);
+        array_free(m->meshlets);
+        array_free(m->indices);
+        array_free(m->texcoords);
+        array_free(m->vertices);
+        vec3_soa_free(&m->positions);
+    }
+    free(m->filename);
+    free(m);
+}
+
+void free_meshes(void) {
+    for (size_t i = 0; i < array_length(meshes); i++) {
+        free_mesh(meshes[i]);
+    }
+    array_free(meshes);
+    meshes = NULL;
 }
@@ -1,19 +1,94 @@
 #ifndef MESH_H
 #define MESH_H
 
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "vector.h"
 #include "triangle.h"
 
+///////////////////////////////////////////////////////////////////////////////
+// A run of consecutive triangles of a mesh, culled as a whole. Everything is
+// in model space: a sphere around the vertices, and a cone around the face
+// normals, whose half angle has cosine cone_cos (<= 0 when it cannot cull).
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    int first_triangle;
+    int num_triangles;
+    vec3_t center;
+    float radius;
+    vec3_t cone_axis;
+    float cone_cos;
+    float cone_sin;
+} meshlet_t;
+
+///////////////////////////////////////////////////////////////////////////////
+// A level of detail: a range of the triangles of the mesh and the meshlets
+// covering it. Level 0 is the full mesh. The error is the largest distance
+// between the level and the full mesh, as a fraction of bounds_radius.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    int first_triangle;
+    int num_triangles;
+    int first_meshlet;
+    int num_meshlets;
+    float error;
+} lod_t;
+
+///////////////////////////////////////////////////////////////////////////////
+// Indexed triangle mesh. Every unique (position, uv) pair of the file is one
+// vertex, and each triangle is three indices into the vertices. Indices are
+// 16-bit when every vertex fits, 32-bit otherwise. The index buffer holds the
+// triangles of every level of detail one after the other; the simplified
+// levels reuse the vertices of the full mesh. A mesh is loaded once per file
+// and only read afterwards: the objects of the scene that show it each have
+// their own transform.
+///////////////////////////////////////////////////////////////////////////////
 typedef struct {
     vec3_t* vertices;
-    face_t* faces;
-    vec3_t rotation;
-    vec3_t scale;
-    vec3_t translation;
+    tex2_t* texcoords;     // UV of each vertex
+    vec3_soa_t positions;  // the vertices again, as aligned x/y/z streams for the batched transforms
+    void* indices;         // three per triangle: uint16_t or uint32_t elements, see index_size
+    int index_size;        // 2 or 4 bytes
+    meshlet_t* meshlets;   // clusters covering every triangle in order
+    lod_t* lods;           // levels of detail, from the full mesh to the coarsest
+    vec3_t bounds_center;  // bounding sphere of the vertices
+    float bounds_radius;
+    vec3_t bounds_min;     // bounding box of the vertices
+    vec3_t bounds_max;
+    uint32_t color;
+    char* filename;      // .OBJ file the mesh was loaded from
+    void* mapped_file;   // mesh cache the arrays point into, NULL when they were allocated by the loader
+    size_t mapped_size;
 } mesh_t;
 
-extern mesh_t mesh;
+// Largest index buffer of a mesh, levels of detail included: the levels, the
+// meshlets and the renderer number the triangles and their corners with int
+#define MESH_MAX_INDICES INT_MAX
+
+static inline int mesh_index(const mesh_t* m, size_t i) {
+    return m->index_size == 2 ? ((const uint16_t*)m->indices)[i] : (int)((const uint32_t*)m->indices)[i];
+}
+
+static inline void mesh_set_index(mesh_t* m, size_t i, int value) {
+    if (m->index_size == 2) {
+        ((uint16_t*)m->indices)[i] = (uint16_t)value;
+    } else {
+        ((uint32_t*)m->indices)[i] = (uint32_t)value;
+    }
+}
+
+// Triangles of all the levels of detail together
+int mesh_num_triangles(const mesh_t* m);
 
-void load_obj_file_data(char* filename);
+mesh_t* load_mesh(char* filename);
+void free_meshes(void);
+bool get_mesh_cache(void);
+void set_mesh_cache(bool enabled);
+bool get_mesh_cache_verify(void);
+void set_mesh_cache_verify(bool enabled);
+bool get_mesh_optimization(void);
+void set_mesh_optimization(bool enabled);
 
 #endif
@@ -0,0 +1,396 @@
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "array.h"
+#include "mesh_cache.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Binary mesh cache
+///////////////////////////////////////////////////////////////////////////////
+// The first time an OBJ file is loaded, its parsed mesh is written next to it
+// as <file>.cache. Later launches map that file read-only and point the mesh
+// arrays straight into the mapping: nothing is parsed or copied, and pages
+// are only read from disk when touched. The load only checks the header and
+// the array headers in front of the sections; set_mesh_cache_verify() also
+// checks every index, meshlet and level and the section checksums, which
+// reads the whole file.
+//
+//   +--------+--------------+--------------+--------------+----------------+------------+-------------------+
+//   | header | [h] vertices | [h] texcoords| [h] indices  | [h] meshlets   | [h] lods   | x... y... z...    |
+//   |        | vec3_t each  | tex2_t each  | 16 or 32 bit | meshlet_t each | lod_t each | positions streams |
+//   +--------+--------------+--------------+--------------+----------------+------------+-------------------+
+//
+// Every section starts on an ARRAY_ALIGNMENT boundary, a cache line, which
+// is also a multiple of SOA_ALIGNMENT. The vertex, texcoord, index, meshlet
+// and LOD sections are preceded by an array header [h], so the mapped
+// pointers work with array_length() like the arrays built by the loader.
+// The positions are stored as the padded x/y/z streams of mesh.positions.
+//
+// The cache is rebuilt when the OBJ file changes size or modification time,
+// when it was written by a different version or a host with other sizes or
+// byte order, or when the mesh optimization setting differs. With
+// verification on, it is also rebuilt when its contents are inconsistent or
+// a section does not match its checksum.
+///////////////////////////////////////////////////////////////////////////////
+
+#define MESH_CACHE_MAGIC "MESHBIN"
+#define MESH_CACHE_ENDIAN 0x01020304
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;             // MESH_CACHE_ENDIAN as stored by the writer
+    uint32_t vertex_size;        // sizeof(vec3_t)
+    uint32_t texcoord_size;      // sizeof(tex2_t)
+    uint32_t index_size;         // 2 or 4
+    uint32_t meshlet_size;       // sizeof(meshlet_t)
+    uint32_t lod_size;           // sizeof(lod_t)
+    uint32_t array_header_size;  // ARRAY_HEADER_SIZE
+    uint32_t num_vertices;
+    uint32_t num_indices;
+    uint32_t num_meshlets;
+    uint32_t num_lods;
+    uint32_t positions_padded;   // length of each positions stream
+    uint32_t color;
+    uint32_t optimized;          // faces and vertices reordered by optimize_mesh()
+    float bounds_center[3];
+    float bounds_radius;
+    float bounds_min[3];
+    float bounds_max[3];
+    uint64_t source_size;        // size and modification time of the OBJ file the cache was built from
+    int64_t source_mtime;
+    uint64_t vertices_offset;    // offsets of the first element of each section
+    uint64_t texcoords_offset;
+    uint64_t indices_offset;
+    uint64_t meshlets_offset;
+    uint64_t lods_offset;
+    uint64_t positions_offset;
+    uint64_t file_size;
+    uint64_t vertices_checksum;
+    uint64_t texcoords_checksum;
+    uint64_t indices_checksum;
+    uint64_t meshlets_checksum;
+    uint64_t lods_checksum;
+    uint64_t positions_checksum;
+} mesh_cache_header_t;
+
+static uint64_t align_offset(uint64_t offset) {
+    return (offset + ARRAY_ALIGNMENT - 1) / ARRAY_ALIGNMENT * ARRAY_ALIGNMENT;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// FNV-1a, fed 8 bytes at a time so that verifying a large cache stays far
+// cheaper than parsing the OBJ file again. The last bytes are fed one by one.
+///////////////////////////////////////////////////////////////////////////////
+static uint64_t checksum(const void* data, size_t size) {
+    const uint64_t prime = 0x100000001b3ULL;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    const unsigned char* bytes = (const unsigned char*)data;
+
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, &bytes[i], sizeof(word));
+        hash = (hash ^ word) * prime;
+    }
+    for (; i < size; i++) {
+        hash = (hash ^ bytes[i]) * prime;
+    }
+    return hash;
+}
+
+static void cache_filename(char* obj_filename, char* filename, size_t size) {
+    snprintf(filename, size, "%s.cache", obj_filename);
+}
+
+// Check that an array header sits right before the section and matches its count
+static bool valid_array_section(const unsigned char* base, uint64_t offset, uint32_t count) {
+    const void* array = base + offset;
+    return array_length(array) == count && array_capacity(array) == count;
+}
+
+static bool valid_header(const unsigned char* base, size_t size, const struct stat* source) {
+    const mesh_cache_header_t* header = (const mesh_cache_header_t*)base;
+    if (size < sizeof(mesh_cache_header_t) ||
+        memcmp(header->magic, MESH_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != MESH_CACHE_VERSION ||
+        header->endian != MESH_CACHE_ENDIAN ||
+        header->vertex_size != sizeof(vec3_t) ||
+        header->texcoord_size != sizeof(tex2_t) ||
+        (header->index_size != 2 && header->index_size != 4) ||
+        header->meshlet_size != sizeof(meshlet_t) ||
+        header->lod_size != sizeof(lod_t) ||
+        header->num_indices % 3 != 0 || header->num_indices > MESH_MAX_INDICES ||
+        header->array_header_size != ARRAY_HEADER_SIZE ||
+        header->optimized != (uint32_t)get_mesh_optimization() ||
+        header->file_size != size) {
+        return false;
+    }
+    if (header->source_size != (uint64_t)source->st_size || header->source_mtime != (int64_t)source->st_mtime) {
+        return false;
+    }
+
+    // Every section must be aligned, in order and inside the file
+    uint64_t vertices_end = header->vertices_offset + (uint64_t)header->num_vertices * sizeof(vec3_t);
+    uint64_t texcoords_end = header->texcoords_offset + (uint64_t)header->num_vertices * sizeof(tex2_t);
+    uint64_t indices_end = header->indices_offset + (uint64_t)header->num_indices * header->index_size;
+    uint64_t meshlets_end = header->meshlets_offset + (uint64_t)header->num_meshlets * sizeof(meshlet_t);
+    uint64_t lods_end = header->lods_offset + (uint64_t)header->num_lods * sizeof(lod_t);
+    uint64_t positions_end = header->positions_offset + 3 * (uint64_t)header->positions_padded * sizeof(float);
+    if (header->vertices_offset % ARRAY_ALIGNMENT != 0 ||
+        header->texcoords_offset % ARRAY_ALIGNMENT != 0 ||
+        header->indices_offset % ARRAY_ALIGNMENT != 0 ||
+        header->meshlets_offset % ARRAY_ALIGNMENT != 0 ||
+        header->lods_offset % ARRAY_ALIGNMENT != 0 ||
+        header->positions_offset % ARRAY_ALIGNMENT != 0 ||
+        header->vertices_offset < sizeof(mesh_cache_header_t) + ARRAY_HEADER_SIZE ||
+        header->texcoords_offset < vertices_end + ARRAY_HEADER_SIZE ||
+        header->indices_offset < texcoords_end + ARRAY_HEADER_SIZE ||
+        header->meshlets_offset < indices_end + ARRAY_HEADER_SIZE ||
+        header->lods_offset < meshlets_end + ARRAY_HEADER_SIZE ||
+        header->positions_offset < lods_end ||
+        positions_end > size ||
+        header->positions_padded < header->num_vertices) {
+        return false;
+    }
+    if (!valid_array_section(base, header->vertices_offset, header->num_vertices) ||
+        !valid_array_section(base, header->texcoords_offset, header->num_vertices) ||
+        !valid_array_section(base, header->indices_offset, header->num_indices) ||
+        !valid_array_section(base, header->meshlets_offset, header->num_meshlets) ||
+        !valid_array_section(base, header->lods_offset, header->num_lods)) {
+        return false;
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Check every section of a cache whose header is valid: the indices, the
+// meshlets and levels against each other, and the checksums. This touches
+// every page of the file.
+///////////////////////////////////////////////////////////////////////////////
+static bool valid_contents(const unsigned char* base) {
+    const mesh_cache_header_t* header = (const mesh_cache_header_t*)base;
+
+    // Every index must point at a vertex
+    for (uint32_t i = 0; i < header->num_indices; i++) {
+        const unsigned char* index = base + header->indices_offset + (uint64_t)i * header->index_size;
+        uint32_t value = header->index_size == 2 ? *(const uint16_t*)index : *(const uint32_t*)index;
+        if (value >= header->num_vertices) {
+            return false;
+        }
+    }
+
+    // The meshlets must cover the triangles in order
+    uint32_t next_triangle = 0;
+    for (uint32_t i = 0; i < header->num_meshlets; i++) {
+        const meshlet_t* meshlet = (const meshlet_t*)(base + header->meshlets_offset) + i;
+        if (meshlet->first_triangle != (int)next_triangle || meshlet->num_triangles <= 0) {
+            return false;
+        }
+        next_triangle += meshlet->num_triangles;
+    }
+    if (next_triangle != header->num_indices / 3) {
+        return false;
+    }
+
+    // The levels must cover the triangles and the meshlets in order, each
+    // level starting on the first meshlet of its triangles
+    uint32_t next_meshlet = 0;
+    next_triangle = 0;
+    for (uint32_t i = 0; i < header->num_lods; i++) {
+        const lod_t* lod = (const lod_t*)(base + header->lods_offset) + i;
+        const meshlet_t* meshlets = (const meshlet_t*)(base + header->meshlets_offset);
+        if (lod->first_triangle != (int)next_triangle || lod->first_meshlet != (int)next_meshlet ||
+            lod->num_triangles < 0 || lod->num_meshlets < 0 ||
+            next_meshlet + lod->num_meshlets > header->num_meshlets ||
+            (lod->num_meshlets > 0 && meshlets[lod->first_meshlet].first_triangle != lod->first_triangle)) {
+            return false;
+        }
+        next_triangle += lod->num_triangles;
+        next_meshlet += lod->num_meshlets;
+    }
+    if (header->num_lods == 0 || next_triangle != header->num_indices / 3 || next_meshlet != header->num_meshlets) {
+        return false;
+    }
+
+    return checksum(base + header->vertices_offset, (size_t)header->num_vertices * sizeof(vec3_t)) == header->vertices_checksum &&
+        checksum(base + header->texcoords_offset, (size_t)header->num_vertices * sizeof(tex2_t)) == header->texcoords_checksum &&
+        checksum(base + header->indices_offset, (size_t)header->num_indices * header->index_size) == header->indices_checksum &&
+        checksum(base + header->meshlets_offset, (size_t)header->num_meshlets * sizeof(meshlet_t)) == header->meshlets_checksum &&
+        checksum(base + header->lods_offset, (size_t)header->num_lods * sizeof(lod_t)) == header->lods_checksum &&
+        checksum(base + header->positions_offset, 3 * (size_t)header->positions_padded * sizeof(float)) == header->positions_checksum;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Map the cache of an OBJ file and point the mesh arrays into it. Returns
+// false, leaving the mesh untouched, if there is no valid cache for the
+// current contents of the OBJ file.
+///////////////////////////////////////////////////////////////////////////////
+bool load_mesh_cache(char* obj_filename, mesh_t* mesh) {
+    struct stat source;
+    if (stat(obj_filename, &source) != 0) {
+        return false;
+    }
+
+    char filename[4096];
+    cache_filename(obj_filename, filename, sizeof(filename));
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat cache;
+    if (fstat(fd, &cache) != 0 || cache.st_size < (off_t)sizeof(mesh_cache_header_t)) {
+        close(fd);
+        return false;
+    }
+
+    size_t size = cache.st_size;
+    void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+
+    const unsigned char* base = (const unsigned char*)mapping;
+    if (!valid_header(base, size, &source) || (get_mesh_cache_verify() && !valid_contents(base))) {
+        fprintf(stderr, "Ignoring out of date mesh cache %s\n", filename);
+        munmap(mapping, size);
+        return false;
+    }
+
+    const mesh_cache_header_t* header = (const mesh_cache_header_t*)base;
+    mesh->vertices = (vec3_t*)(base + header->vertices_offset);
+    mesh->texcoords = (tex2_t*)(base + header->texcoords_offset);
+    mesh->indices = (void*)(base + header->indices_offset);
+    mesh->index_size = header->index_size;
+    mesh->meshlets = (meshlet_t*)(base + header->meshlets_offset);
+    mesh->lods = (lod_t*)(base + header->lods_offset);
+    mesh->bounds_center = vec3_new(header->bounds_center[0], header->bounds_center[1], header->bounds_center[2]);
+    mesh->bounds_radius = header->bounds_radius;
+    mesh->bounds_min = vec3_new(header->bounds_min[0], header->bounds_min[1], header->bounds_min[2]);
+    mesh->bounds_max = vec3_new(header->bounds_max[0], header->bounds_max[1], header->bounds_max[2]);
+    mesh->color = header->color;
+
+    float* positions = (float*)(base + header->positions_offset);
+    mesh->positions.x = positions;
+    mesh->positions.y = positions + header->positions_padded;
+    mesh->positions.z = positions + header->positions_padded * 2;
+    mesh->positions.count = header->num_vertices;
+    mesh->positions.padded = header->positions_padded;
+    mesh->positions.memory = NULL;
+
+    mesh->mapped_file = mapping;
+    mesh->mapped_size = size;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Write the cache of a freshly parsed mesh. The file is written under a
+// temporary name and renamed into place, so a concurrent reader only ever
+// sees a complete cache.
+///////////////////////////////////////////////////////////////////////////////
+bool save_mesh_cache(char* obj_filename, mesh_t* mesh) {
+    struct stat source;
+    if (stat(obj_filename, &source) != 0) {
+        return false;
+    }
+
+    uint32_t num_vertices = array_length(mesh->vertices);
+    uint32_t num_indices = array_length(mesh->indices);
+    uint32_t index_size = mesh->index_size;
+    uint32_t num_meshlets = array_length(mesh->meshlets);
+    uint32_t num_lods = array_length(mesh->lods);
+    uint32_t padded = mesh->positions.padded;
+
+    mesh_cache_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+    header.version = MESH_CACHE_VERSION;
+    header.endian = MESH_CACHE_ENDIAN;
+    header.vertex_size = sizeof(vec3_t);
+    header.texcoord_size = sizeof(tex2_t);
+    header.index_size = index_size;
+    header.meshlet_size = sizeof(meshlet_t);
+    header.lod_size = sizeof(lod_t);
+    header.array_header_size = ARRAY_HEADER_SIZE;
+    header.num_vertices = num_vertices;
+    header.num_indices = num_indices;
+    header.num_meshlets = num_meshlets;
+    header.num_lods = num_lods;
+    header.positions_padded = padded;
+    header.color = mesh->color;
+    header.optimized = get_mesh_optimization();
+    header.bounds_center[0] = mesh->bounds_center.x;
+    header.bounds_center[1] = mesh->bounds_center.y;
+    header.bounds_center[2] = mesh->bounds_center.z;
+    header.bounds_radius = mesh->bounds_radius;
+    header.bounds_min[0] = mesh->bounds_min.x;
+    header.bounds_min[1] = mesh->bounds_min.y;
+    header.bounds_min[2] = mesh->bounds_min.z;
+    header.bounds_max[0] = mesh->bounds_max.x;
+    header.bounds_max[1] = mesh->bounds_max.y;
+    header.bounds_max[2] = mesh->bounds_max.z;
+    header.source_size = source.st_size;
+    header.source_mtime = source.st_mtime;
+    header.vertices_offset = align_offset(sizeof(mesh_cache_header_t) + ARRAY_HEADER_SIZE);
+    header.texcoords_offset = align_offset(header.vertices_offset + (uint64_t)num_vertices * sizeof(vec3_t) + ARRAY_HEADER_SIZE);
+    header.indices_offset = align_offset(header.texcoords_offset + (uint64_t)num_vertices * sizeof(tex2_t) + ARRAY_HEADER_SIZE);
+    header.meshlets_offset = align_offset(header.indices_offset + (uint64_t)num_indices * index_size + ARRAY_HEADER_SIZE);
+    header.lods_offset = align_offset(header.meshlets_offset + (uint64_t)num_meshlets * sizeof(meshlet_t) + ARRAY_HEADER_SIZE);
+    header.positions_offset = align_offset(header.lods_offset + (uint64_t)num_lods * sizeof(lod_t));
+    header.file_size = header.positions_offset + 3 * (uint64_t)padded * sizeof(float);
+
+    unsigned char* buffer = (unsigned char*)calloc(1, header.file_size);
+    if (!buffer) {
+        return false;
+    }
+    memcpy(array_place(buffer + header.vertices_offset - ARRAY_HEADER_SIZE, num_vertices), mesh->vertices, num_vertices * sizeof(vec3_t));
+    memcpy(array_place(buffer + header.texcoords_offset - ARRAY_HEADER_SIZE, num_vertices), mesh->texcoords, num_vertices * sizeof(tex2_t));
+    memcpy(array_place(buffer + header.indices_offset - ARRAY_HEADER_SIZE, num_indices), mesh->indices, (size_t)num_indices * index_size);
+    memcpy(array_place(buffer + header.meshlets_offset - ARRAY_HEADER_SIZE, num_meshlets), mesh->meshlets, num_meshlets * sizeof(meshlet_t));
+    memcpy(array_place(buffer + header.lods_offset - ARRAY_HEADER_SIZE, num_lods), mesh->lods, num_lods * sizeof(lod_t));
+    memcpy(buffer + header.positions_offset, mesh->positions.x, padded * sizeof(float));
+    memcpy(buffer + header.positions_offset + padded * sizeof(float), mesh->positions.y, padded * sizeof(float));
+    memcpy(buffer + header.positions_offset + 2 * padded * sizeof(float), mesh->positions.z, padded * sizeof(float));
+
+    header.vertices_checksum = checksum(buffer + header.vertices_offset, num_vertices * sizeof(vec3_t));
+    header.texcoords_checksum = checksum(buffer + header.texcoords_offset, num_vertices * sizeof(tex2_t));
+    header.indices_checksum = checksum(buffer + header.indices_offset, (size_t)num_indices * index_size);
+    header.meshlets_checksum = checksum(buffer + header.meshlets_offset, num_meshlets * sizeof(meshlet_t));
+    header.lods_checksum = checksum(buffer + header.lods_offset, num_lods * sizeof(lod_t));
+    header.positions_checksum = checksum(buffer + header.positions_offset, 3 * padded * sizeof(float));
+    memcpy(buffer, &header, sizeof(header));
+
+    char filename[4096];
+    char temporary_filename[4096 + 32];
+    cache_filename(obj_filename, filename, sizeof(filename));
+    snprintf(temporary_filename, sizeof(temporary_filename), "%s.%ld.tmp", filename, (long)getpid());
+
+    FILE* file = fopen(temporary_filename, "wb");
+    bool saved = file != NULL && fwrite(buffer, 1, header.file_size, file) == header.file_size;
+    if (file != NULL && fclose(file) != 0) {
+        saved = false;
+    }
+    free(buffer);
+
+    if (!saved || rename(temporary_filename, filename) != 0) {
+        remove(temporary_filename);
+        fprintf(stderr, "Cannot write mesh cache %s\n", filename);
+        return false;
+    }
+    return true;
+}
+
+void unmap_mesh_cache(mesh_t* mesh) {
+    if (mesh->mapped_file) {
+        munmap(mesh->mapped_file, mesh->mapped_size);
+        mesh->mapped_file = NULL;
+        mesh->mapped_size = 0;
+    }
+}
@@ -0,0 +1,14 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <stdbool.h>
+#include "mesh.h"
+
+// Bump whenever the layout of the file or of the cached structures changes
+#define MESH_CACHE_VERSION 7
+
+bool load_mesh_cache(char* obj_filename, mesh_t* mesh);
+bool save_mesh_cache(char* obj_filename, mesh_t* mesh);
+void unmap_mesh_cache(mesh_t* mesh);
+
+#endif
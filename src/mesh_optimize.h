@@ -0,0 +1,13 @@
+#ifndef MESH_OPTIMIZE_H
+#define MESH_OPTIMIZE_H
+
+#include "mesh.h"
+
+// Size of the post-transform vertex cache the face order is tuned for
+#define VERTEX_CACHE_SIZE 32
+
+float mesh_acmr(const mesh_t* m, int cache_size);
+void optimize_triangle_order(mesh_t* m, int first_triangle, int num_triangles);
+void optimize_mesh(mesh_t* m);
+
+#endif
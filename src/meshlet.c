@@ -0,0 +1,168 @@
+#include <math.h>
+#include <stdlib.h>
+#include "array.h"
+#include "clipping.h"
+#include "meshlet.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Meshlets
+///////////////////////////////////////////////////////////////////////////////
+// The triangles are cut into runs of MESHLET_MIN_TRIANGLES to
+// MESHLET_MAX_TRIANGLES in index order. After the vertex cache optimization
+// that order already walks the surface patch by patch, so a run is closed
+// early only when the next face leaves the patch: once the minimum size is
+// reached, a face that shares no vertex with the run or bends away from its
+// average normal starts a new meshlet.
+//
+// Each frame, update() tests the bounds of a meshlet before touching any of
+// its faces, and skips it entirely when it is outside the frustum or when
+// every face in it points away from the camera.
+///////////////////////////////////////////////////////////////////////////////
+
+static vec3_t face_normal(const mesh_t* m, int triangle) {
+    vec3_t a = m->vertices[mesh_index(m, triangle * 3 + 0)];
+    vec3_t b = m->vertices[mesh_index(m, triangle * 3 + 1)];
+    vec3_t c = m->vertices[mesh_index(m, triangle * 3 + 2)];
+    vec3_t normal = vec3_cross(vec3_sub(b, a), vec3_sub(c, a));
+    if (vec3_length(normal) > 0) {
+        vec3_normalize(&normal);
+    }
+    return normal;
+}
+
+// Bounding sphere and normal cone of the triangles of a meshlet
+static void compute_meshlet_bounds(const mesh_t* m, meshlet_t* meshlet) {
+    vec3_t min = m->vertices[mesh_index(m, meshlet->first_triangle * 3)];
+    vec3_t max = min;
+    vec3_t normal_sum = { 0, 0, 0 };
+    int end = meshlet->first_triangle + meshlet->num_triangles;
+
+    for (int t = meshlet->first_triangle; t < end; t++) {
+        for (int k = 0; k < 3; k++) {
+            vec3_t v = m->vertices[mesh_index(m, t * 3 + k)];
+            min.x = fminf(min.x, v.x); max.x = fmaxf(max.x, v.x);
+            min.y = fminf(min.y, v.y); max.y = fmaxf(max.y, v.y);
+            min.z = fminf(min.z, v.z); max.z = fmaxf(max.z, v.z);
+        }
+        normal_sum = vec3_add(normal_sum, face_normal(m, t));
+    }
+
+    meshlet->center = vec3_mul(vec3_add(min, max), 0.5);
+    meshlet->radius = 0;
+    for (int t = meshlet->first_triangle; t < end; t++) {
+        for (int k = 0; k < 3; k++) {
+            vec3_t v = m->vertices[mesh_index(m, t * 3 + k)];
+            meshlet->radius = fmaxf(meshlet->radius, vec3_length(vec3_sub(v, meshlet->center)));
+        }
+    }
+
+    // The cone is the average normal widened to the face furthest from it
+    meshlet->cone_axis = normal_sum;
+    float min_dot = -1.0f;
+    if (vec3_length(normal_sum) > 0) {
+        vec3_normalize(&meshlet->cone_axis);
+        min_dot = 1.0f;
+    }
+    for (int t = meshlet->first_triangle; t < end && min_dot > 0; t++) {
+        min_dot = fminf(min_dot, vec3_dot(face_normal(m, t), meshlet->cone_axis));
+    }
+    meshlet->cone_cos = min_dot;
+    meshlet->cone_sin = min_dot > 0 ? sqrtf(1.0f - min_dot * min_dot) : 1.0f;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Cut a range of the triangles of the mesh into meshlets, compute their
+// bounds and append them to the meshlets array, which is returned
+///////////////////////////////////////////////////////////////////////////////
+meshlet_t* build_meshlets(const mesh_t* m, int first_triangle, int num_triangles, meshlet_t* meshlets) {
+    int num_vertices = array_length(m->vertices);
+    int end = first_triangle + num_triangles;
+
+    // Meshlet that last used each vertex, to tell whether a face touches the current one
+    int* vertex_meshlet = (int*)malloc(sizeof(int) * (num_vertices ? num_vertices : 1));
+    for (int v = 0; v < num_vertices; v++) {
+        vertex_meshlet[v] = -1;
+    }
+
+    meshlet_t meshlet = { .first_triangle = first_triangle };
+    vec3_t normal_sum = { 0, 0, 0 };
+    for (int t = first_triangle; t < end; t++) {
+        int current = array_length(meshlets);
+        vec3_t normal = face_normal(m, t);
+
+        if (meshlet.num_triangles >= MESHLET_MIN_TRIANGLES) {
+            bool connected = false;
+            for (int k = 0; k < 3; k++) {
+                connected |= vertex_meshlet[mesh_index(m, t * 3 + k)] == current;
+            }
+            // dot(normal, axis) < split, with the axis left unnormalized
+            bool bent = vec3_dot(normal, normal_sum) < MESHLET_CONE_SPLIT * vec3_length(normal_sum);
+
+            if (meshlet.num_triangles == MESHLET_MAX_TRIANGLES || !connected || bent) {
+                compute_meshlet_bounds(m, &meshlet);
+                array_push(meshlets, meshlet);
+                meshlet.first_triangle = t;
+                meshlet.num_triangles = 0;
+                normal_sum = vec3_new(0, 0, 0);
+                current++;
+            }
+        }
+
+        for (int k = 0; k < 3; k++) {
+            vertex_meshlet[mesh_index(m, t * 3 + k)] = current;
+        }
+        normal_sum = vec3_add(normal_sum, normal);
+        meshlet.num_triangles++;
+    }
+    if (meshlet.num_triangles > 0) {
+        compute_meshlet_bounds(m, &meshlet);
+        array_push(meshlets, meshlet);
+    }
+
+    free(vertex_meshlet);
+    return meshlets;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Test a meshlet in camera space, where the camera sits at the origin. The
+// radius grows by max_scale, the largest scale factor of the model-view
+// matrix. The cone test is only valid when that scale is uniform and
+// positive, so the caller turns off cull_backfaces otherwise.
+//
+// A face is culled as a backface when its normal N and any of its points P
+// have dot(N, P) > 0. For a cone of half angle a around the axis, seen at an
+// angle b from the direction of the sphere center C, every normal is at most
+// a + b from C; when a + b < 90 degrees each point of the sphere has
+// dot(N, P) >= |C| * cos(a + b) - radius, so all faces are backfaces when
+// that is positive.
+///////////////////////////////////////////////////////////////////////////////
+bool meshlet_visible(const meshlet_t* meshlet, const mat4_t* model_view, float max_scale, bool cull_backfaces) {
+    vec3_t center = vec3_from_vec4(mat4_mul_vec4(*model_view, vec4_from_vec3(meshlet->center)));
+    float radius = meshlet->radius * max_scale;
+
+    if (sphere_outside_frustum(center, radius)) {
+        return false;
+    }
+
+    if (!cull_backfaces || meshlet->cone_cos <= 0) {
+        return true;
+    }
+
+    // The axis is a direction: w = 0 leaves out the translation
+    vec4_t axis4 = vec4_from_vec3(meshlet->cone_axis);
+    axis4.w = 0;
+    vec3_t axis = vec3_from_vec4(mat4_mul_vec4(*model_view, axis4));
+    vec3_normalize(&axis);
+
+    float distance = vec3_length(center);
+    if (distance <= radius) {
+        return true;
+    }
+    float cos_b = vec3_dot(center, axis) / distance;
+    if (cos_b <= 0) {
+        return true;
+    }
+    float sin_b = sqrtf(fmaxf(0.0f, 1.0f - cos_b * cos_b));
+    float cos_ab = cos_b * meshlet->cone_cos - sin_b * meshlet->cone_sin;
+    return distance * cos_ab <= radius;
+}
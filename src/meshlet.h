@@ -0,0 +1,17 @@
+#ifndef MESHLET_H
+#define MESHLET_H
+
+#include <stdbool.h>
+#include "matrix.h"
+#include "mesh.h"
+
+#define MESHLET_MIN_TRIANGLES 64
+#define MESHLET_MAX_TRIANGLES 128
+
+// Past the minimum size, a meshlet ends at a face bent further than this from its average normal
+#define MESHLET_CONE_SPLIT 0.7f
+
+meshlet_t* build_meshlets(const mesh_t* m, int first_triangle, int num_triangles, meshlet_t* meshlets);
+bool meshlet_visible(const meshlet_t* meshlet, const mat4_t* model_view, float max_scale, bool cull_backfaces);
+
+#endif
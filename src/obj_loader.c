@@ -0,0 +1,489 @@
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <SDL2/SDL.h>
+#include "array.h"
+#include "obj_loader.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// OBJ file parser
+///////////////////////////////////////////////////////////////////////////////
+// The file is mapped into memory and cut into one chunk per CPU, each ending
+// right after a newline so no line is split between two chunks. The chunks
+// are parsed in parallel into their own vertex, texcoord and face arrays,
+// then merged in file order:
+//
+//   file:   | v v v vt vt f f | v vt vt f f f | f f f f f |
+//             chunk 0           chunk 1         chunk 2
+//   merge:  vertices  = v(0) + v(1) + v(2)
+//           texcoords = vt(0) + vt(1) + vt(2)
+//           faces     = f(0) + f(1) + f(2), UVs looked up in the merged texcoords
+//
+// OBJ indices are global: 1-based, or negative to count back from the last
+// element declared before the face. The faces of a chunk keep their raw
+// indices, with the number of elements the chunk had declared before them,
+// until the merge, when the counts of the previous chunks are known.
+// Polygons are triangulated during the merge, so the rest of the renderer
+// only ever sees triangles. Each chunk counts its lines before parsing them
+// and the merge counts the triangles, so every array is sized once. Numbers
+// are parsed by hand: no locale, no sscanf, and no limit on the length of a
+// line.
+///////////////////////////////////////////////////////////////////////////////
+
+// Files smaller than this are parsed on the calling thread only
+#define OBJ_PARALLEL_MIN_SIZE (1 << 20)
+#define OBJ_MAX_CHUNKS 64
+
+// Resolved index of a corner with no texcoord, or pointing at nothing
+#define OBJ_NO_INDEX SIZE_MAX
+
+// A corner of a face as written in the file: vertex and texcoord indices, 0 when absent
+typedef struct {
+    int64_t v;
+    int64_t vt;
+} obj_vertex_ref_t;
+
+// A face with any number of corners, stored in the refs array of its chunk
+typedef struct {
+    size_t first_ref;
+    size_t num_refs;
+    size_t num_vertices;   // vertices and texcoords the chunk declared before the face,
+    size_t num_texcoords;  // to resolve negative indices
+} obj_face_t;
+
+typedef struct {
+    const char* begin;
+    const char* end;
+    vec3_t* vertices;
+    tex2_t* texcoords;
+    obj_vertex_ref_t* refs;
+    obj_face_t* faces;
+} obj_chunk_t;
+
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static const char* skip_spaces(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    return p;
+}
+
+static double power_of_ten(int exponent) {
+    static const double exact[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    double result = 1.0;
+    while (exponent > 22) {
+        result *= 1e22;
+        exponent -= 22;
+    }
+    return result * exact[exponent];
+}
+
+// Parse an optionally signed integer. Returns the first character after it.
+static const char* parse_int(const char* p, const char* end, int64_t* value) {
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    int64_t result = 0;
+    while (p < end && is_digit(*p)) {
+        result = result * 10 + (*p - '0');
+        p++;
+    }
+    *value = negative ? -result : result;
+    return p;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Parse a decimal number like -12.5e-3. The significant digits are gathered
+// in an integer (up to 19 of them) and scaled once by a power of ten, which
+// is exact up to 1e22, so the result rounds like strtof on mesh data.
+// Returns the first character after the number.
+///////////////////////////////////////////////////////////////////////////////
+static const char* parse_float(const char* p, const char* end, float* value) {
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    for (; p < end && is_digit(*p); p++) {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += mantissa != 0;
+        } else {
+            exponent++;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && is_digit(*p); p++) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits += mantissa != 0;
+                exponent--;
+            }
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        int64_t e;
+        p = parse_int(p + 1, end, &e);
+        if (e < -400) e = -400;
+        if (e > 400) e = 400;
+        exponent += (int)e;
+    }
+
+    if (exponent < -400) exponent = -400;
+    if (exponent > 400) exponent = 400;
+    double result = (double)mantissa;
+    result = exponent < 0 ? result / power_of_ten(-exponent) : result * power_of_ten(exponent);
+    *value = (float)(negative ? -result : result);
+    return p;
+}
+
+// Parse a face vertex reference: v, v/vt, v//vn or v/vt/vn
+static const char* parse_face_vertex(const char* p, const char* end, int64_t* v, int64_t* vt) {
+    int64_t vn;
+    *vt = 0;
+    p = parse_int(p, end, v);
+    if (p < end && *p == '/') {
+        p++;
+        if (p < end && *p != '/') {
+            p = parse_int(p, end, vt);
+        }
+        if (p < end && *p == '/') {
+            p = parse_int(p + 1, end, &vn);
+        }
+    }
+    return p;
+}
+
+static void parse_line(obj_chunk_t* chunk, const char* p, const char* end) {
+    p = skip_spaces(p, end);
+    if (end - p < 2) {
+        return;
+    }
+
+    if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+        vec3_t vertex;
+        p = parse_float(skip_spaces(p + 2, end), end, &vertex.x);
+        p = parse_float(skip_spaces(p, end), end, &vertex.y);
+        p = parse_float(skip_spaces(p, end), end, &vertex.z);
+        array_push(chunk->vertices, vertex);
+    } else if (p[0] == 'v' && p[1] == 't' && end - p > 2 && (p[2] == ' ' || p[2] == '\t')) {
+        tex2_t texcoord;
+        p = parse_float(skip_spaces(p + 3, end), end, &texcoord.u);
+        p = parse_float(skip_spaces(p, end), end, &texcoord.v);
+        array_push(chunk->texcoords, texcoord);
+    } else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+        obj_face_t face = {
+            .first_ref = array_length(chunk->refs),
+            .num_refs = 0,
+            .num_vertices = array_length(chunk->vertices),
+            .num_texcoords = array_length(chunk->texcoords)
+        };
+        for (p = skip_spaces(p + 2, end); p < end && *p != '#'; p = skip_spaces(p, end)) {
+            obj_vertex_ref_t ref;
+            const char* next = parse_face_vertex(p, end, &ref.v, &ref.vt);
+            if (next == p) {
+                break;
+            }
+            p = next;
+            array_push(chunk->refs, ref);
+            face.num_refs++;
+        }
+        if (face.num_refs >= 3) {
+            array_push(chunk->faces, face);
+        }
+    }
+}
+
+// Count the vertex, texcoord and face lines of the chunk, and reserve its arrays for them
+static void reserve_chunk(obj_chunk_t* chunk) {
+    size_t num_vertices = 0, num_texcoords = 0, num_faces = 0;
+    const char* p = chunk->begin;
+    while (p < chunk->end) {
+        const char* line_end = (const char*)memchr(p, '\n', chunk->end - p);
+        if (!line_end) {
+            line_end = chunk->end;
+        }
+        const char* q = skip_spaces(p, line_end);
+        if (line_end - q >= 2 && q[0] == 'v') {
+            num_vertices += q[1] == ' ' || q[1] == '\t';
+            num_texcoords += q[1] == 't';
+        } else if (line_end - q >= 2 && q[0] == 'f') {
+            num_faces += q[1] == ' ' || q[1] == '\t';
+        }
+        p = line_end + 1;
+    }
+    array_reserve(chunk->vertices, num_vertices);
+    array_reserve(chunk->texcoords, num_texcoords);
+    array_reserve(chunk->faces, num_faces);
+    array_reserve(chunk->refs, num_faces * 3);
+}
+
+static int parse_chunk(void* data) {
+    obj_chunk_t* chunk = (obj_chunk_t*)data;
+    reserve_chunk(chunk);
+    const char* p = chunk->begin;
+    while (p < chunk->end) {
+        const char* line_end = (const char*)memchr(p, '\n', chunk->end - p);
+        if (!line_end) {
+            line_end = chunk->end;
+        }
+        // Leave out the \r of Windows line endings
+        const char* content_end = (line_end > p && line_end[-1] == '\r') ? line_end - 1 : line_end;
+        parse_line(chunk, p, content_end);
+        p = line_end + 1;
+    }
+    return 0;
+}
+
+// Turn a raw OBJ index into a 0-based one. Negative indices count back from
+// the last element declared before the face. Returns OBJ_NO_INDEX for absent
+// or invalid ones.
+static size_t resolve_index(int64_t index, size_t num_declared, size_t num_total) {
+    size_t resolved;
+    if (index > 0) {
+        resolved = (size_t)(index - 1);
+    } else if (index < 0 && (uint64_t)0 - (uint64_t)index <= num_declared) {
+        resolved = num_declared - (size_t)((uint64_t)0 - (uint64_t)index);
+    } else {
+        return OBJ_NO_INDEX;
+    }
+    return resolved < num_total ? resolved : OBJ_NO_INDEX;
+}
+
+// Corners of the polygon being triangulated, with their resolved indices
+typedef struct {
+    size_t v;
+    size_t vt;
+    float x, y;  // position projected on the plane of the polygon
+} polygon_corner_t;
+
+static float cross_2d(const polygon_corner_t* a, const polygon_corner_t* b, const polygon_corner_t* c) {
+    return (b->x - a->x) * (c->y - a->y) - (b->y - a->y) * (c->x - a->x);
+}
+
+static bool point_in_triangle(const polygon_corner_t* p, const polygon_corner_t* a, const polygon_corner_t* b, const polygon_corner_t* c) {
+    return cross_2d(a, b, p) >= 0 && cross_2d(b, c, p) >= 0 && cross_2d(c, a, p) >= 0;
+}
+
+static void push_triangle(obj_data_t* obj, tex2_t* texcoords, polygon_corner_t* a, polygon_corner_t* b, polygon_corner_t* c) {
+    tex2_t none = { 0, 0 };
+    face_t face = {
+        .a = a->v,
+        .b = b->v,
+        .c = c->v,
+        .a_uv = a->vt != OBJ_NO_INDEX ? texcoords[a->vt] : none,
+        .b_uv = b->vt != OBJ_NO_INDEX ? texcoords[b->vt] : none,
+        .c_uv = c->vt != OBJ_NO_INDEX ? texcoords[c->vt] : none,
+        .color = 0xFFFFFFFF
+    };
+    array_push(obj->faces, face);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Split a polygon into triangles that keep its winding, by ear clipping.
+// The polygon is projected on the plane facing its Newell normal, oriented
+// counter-clockwise, and a corner is cut off whenever it is convex and no
+// other corner lies inside the triangle it forms with its neighbours. If no
+// ear is found (self-intersecting or degenerate polygons) the remaining
+// corners are fanned.
+///////////////////////////////////////////////////////////////////////////////
+static void triangulate_polygon(obj_data_t* obj, tex2_t* texcoords, polygon_corner_t* corners, size_t n) {
+    if (n == 3) {
+        push_triangle(obj, texcoords, &corners[0], &corners[1], &corners[2]);
+        return;
+    }
+
+    // Newell normal of the polygon, then drop its largest axis to project on a 2D plane
+    vec3_t normal = { 0, 0, 0 };
+    for (size_t i = 0; i < n; i++) {
+        vec3_t a = obj->vertices[corners[i].v];
+        vec3_t b = obj->vertices[corners[(i + 1) % n].v];
+        normal.x += (a.y - b.y) * (a.z + b.z);
+        normal.y += (a.z - b.z) * (a.x + b.x);
+        normal.z += (a.x - b.x) * (a.y + b.y);
+    }
+    float ax = fabsf(normal.x), ay = fabsf(normal.y), az = fabsf(normal.z);
+    float flip = (az >= ax && az >= ay) ? normal.z : (ax >= ay ? normal.x : normal.y);
+    for (size_t i = 0; i < n; i++) {
+        vec3_t v = obj->vertices[corners[i].v];
+        if (az >= ax && az >= ay) {
+            corners[i].x = v.x; corners[i].y = v.y;
+        } else if (ax >= ay) {
+            corners[i].x = v.y; corners[i].y = v.z;
+        } else {
+            corners[i].x = v.z; corners[i].y = v.x;
+        }
+        // Make the projected polygon counter-clockwise
+        if (flip < 0) {
+            corners[i].x = -corners[i].x;
+        }
+    }
+
+    while (n > 3) {
+        bool clipped = false;
+        for (size_t i = 0; i < n && !clipped; i++) {
+            polygon_corner_t* prev = &corners[(i + n - 1) % n];
+            polygon_corner_t* ear = &corners[i];
+            polygon_corner_t* next = &corners[(i + 1) % n];
+            if (cross_2d(prev, ear, next) <= 0) {
+                continue;
+            }
+            bool empty = true;
+            for (size_t j = 0; j < n && empty; j++) {
+                polygon_corner_t* p = &corners[j];
+                if (p != prev && p != ear && p != next && point_in_triangle(p, prev, ear, next)) {
+                    empty = false;
+                }
+            }
+            if (empty) {
+                push_triangle(obj, texcoords, prev, ear, next);
+                memmove(&corners[i], &corners[i + 1], sizeof(polygon_corner_t) * (n - i - 1));
+                n--;
+                clipped = true;
+            }
+        }
+        if (!clipped) {
+            break;
+        }
+    }
+    for (size_t i = 1; i + 1 < n; i++) {
+        push_triangle(obj, texcoords, &corners[0], &corners[i], &corners[i + 1]);
+    }
+}
+
+static void merge_chunks(obj_chunk_t* chunks, int num_chunks, obj_data_t* obj) {
+    size_t num_vertices = 0, num_texcoords = 0, max_refs = 0, num_triangles = 0;
+    for (int i = 0; i < num_chunks; i++) {
+        num_vertices += array_length(chunks[i].vertices);
+        num_texcoords += array_length(chunks[i].texcoords);
+        for (size_t j = 0; j < array_length(chunks[i].faces); j++) {
+            if (chunks[i].faces[j].num_refs > max_refs) max_refs = chunks[i].faces[j].num_refs;
+            num_triangles += chunks[i].faces[j].num_refs - 2;
+        }
+    }
+    array_reserve(obj->faces, array_length(obj->faces) + num_triangles);
+
+    tex2_t* texcoords = NULL;
+    if (num_vertices) array_reserve(obj->vertices, num_vertices);
+    if (num_texcoords) array_reserve(texcoords, num_texcoords);
+    for (int i = 0; i < num_chunks; i++) {
+        array_append(obj->vertices, chunks[i].vertices, array_length(chunks[i].vertices));
+        array_append(texcoords, chunks[i].texcoords, array_length(chunks[i].texcoords));
+    }
+
+    polygon_corner_t* corners = (polygon_corner_t*)malloc(sizeof(polygon_corner_t) * (max_refs ? max_refs : 1));
+    size_t vertex_offset = 0, texcoord_offset = 0;
+    for (int i = 0; i < num_chunks; i++) {
+        for (size_t j = 0; j < array_length(chunks[i].faces); j++) {
+            obj_face_t* raw = &chunks[i].faces[j];
+            bool valid = true;
+            for (size_t k = 0; k < raw->num_refs; k++) {
+                obj_vertex_ref_t* ref = &chunks[i].refs[raw->first_ref + k];
+                corners[k].v = resolve_index(ref->v, vertex_offset + raw->num_vertices, num_vertices);
+                corners[k].vt = resolve_index(ref->vt, texcoord_offset + raw->num_texcoords, num_texcoords);
+                valid = valid && corners[k].v != OBJ_NO_INDEX;
+            }
+            // Faces pointing at vertices that do not exist are dropped
+            if (valid) {
+                triangulate_polygon(obj, texcoords, corners, raw->num_refs);
+            }
+        }
+        vertex_offset += array_length(chunks[i].vertices);
+        texcoord_offset += array_length(chunks[i].texcoords);
+    }
+    free(corners);
+    array_free(texcoords);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Load the vertices and faces of an OBJ file. Returns false if
+// the file cannot be read.
+///////////////////////////////////////////////////////////////////////////////
+bool parse_obj_file(char* filename, obj_data_t* obj) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+        close(fd);
+        return false;
+    }
+    size_t size = file_stat.st_size;
+    if (size == 0) {
+        close(fd);
+        return true;
+    }
+    const char* data = (const char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    int num_chunks = size < OBJ_PARALLEL_MIN_SIZE ? 1 : SDL_GetCPUCount();
+    if (num_chunks < 1) num_chunks = 1;
+    if (num_chunks > OBJ_MAX_CHUNKS) num_chunks = OBJ_MAX_CHUNKS;
+
+    // Cut the file in roughly equal chunks, moving every cut past the end of its line
+    obj_chunk_t chunks[OBJ_MAX_CHUNKS];
+    memset(chunks, 0, sizeof(chunks));
+    const char* end = data + size;
+    const char* begin = data;
+    for (int i = 0; i < num_chunks; i++) {
+        const char* cut = (i == num_chunks - 1) ? end : data + size / num_chunks * (i + 1);
+        if (cut < begin) {
+            cut = begin;
+        }
+        if (cut < end) {
+            const char* newline = (const char*)memchr(cut, '\n', end - cut);
+            cut = newline ? newline + 1 : end;
+        }
+        chunks[i].begin = begin;
+        chunks[i].end = cut;
+        begin = cut;
+    }
+
+    // The calling thread parses the first chunk while the others run on their own threads
+    SDL_Thread* threads[OBJ_MAX_CHUNKS] = { NULL };
+    for (int i = 1; i < num_chunks; i++) {
+        threads[i] = SDL_CreateThread(parse_chunk, "obj", &chunks[i]);
+        if (!threads[i]) {
+            parse_chunk(&chunks[i]);
+        }
+    }
+    parse_chunk(&chunks[0]);
+    for (int i = 1; i < num_chunks; i++) {
+        if (threads[i]) {
+            SDL_WaitThread(threads[i], NULL);
+        }
+    }
+    munmap((void*)data, size);
+
+    merge_chunks(chunks, num_chunks, obj);
+    for (int i = 0; i < num_chunks; i++) {
+        array_free(chunks[i].vertices);
+        array_free(chunks[i].texcoords);
+        array_free(chunks[i].refs);
+        array_free(chunks[i].faces);
+    }
+    return true;
+}
@@ -0,0 +1,16 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include <stdbool.h>
+#include "triangle.h"
+#include "vector.h"
+
+// The faces of the file, triangulated, each carrying its own UVs
+typedef struct {
+    vec3_t* vertices;
+    face_t* faces;
+} obj_data_t;
+
+bool parse_obj_file(char* filename, obj_data_t* obj);
+
+#endif
@@ -0,0 +1,867 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "display.h"
+#include "rasterizer.h"
+#include "stats.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Half-space (edge function) rasterizer
+///////////////////////////////////////////////////////////////////////////////
+// Each edge A->B of the triangle splits the screen in two halves. The edge
+// function
+//
+//     E(P) = (B.x - A.x) * (P.y - A.y) - (B.y - A.y) * (P.x - A.x)
+//
+// is positive on the inner side, negative on the outer side and zero on the
+// edge itself, so a pixel is inside the triangle when all three edge
+// functions are non-negative. E is linear in x and y: stepping one pixel to
+// the right adds a constant and stepping one row down adds another, so the
+// three equations are set up once per triangle and the loops only add.
+//
+// The edge function of the edge opposite to a vertex is also the (unscaled)
+// barycentric weight of that vertex, so 1/w, u/w and v/w are set up from the
+// same values as planes that are stepped just like the edges.
+//
+//         (v0)
+//         /  \          E0: v1 -> v2, opposite v0
+//   E2   /    \   E1    E1: v2 -> v0, opposite v1
+//       /      \        E2: v0 -> v1, opposite v2
+//    (v1)------(v2)
+//           E0
+//
+// RASTER_HALFSPACE works on the truncated integer vertex positions and
+// samples pixel corners, with every edge inclusive.
+//
+// RASTER_SUBPIXEL snaps the vertices to 28.4 fixed point and samples pixel
+// centers. Pixels exactly on an edge only belong to the triangle if the edge
+// is a top edge (horizontal, with the triangle below it) or a left edge. Two
+// triangles sharing an edge then never both cover, or both miss, a pixel on
+// it: every pixel is written exactly once.
+///////////////////////////////////////////////////////////////////////////////
+
+#define SUBPIXEL_BITS 4
+#define SUBPIXEL_SCALE (1 << SUBPIXEL_BITS)
+
+typedef struct {
+    int min_x, min_y, max_x, max_y;  // bounding box in pixels, clamped to the clip rectangle
+    int64_t w0_row, w1_row, w2_row;  // edge functions at the sample of pixel (min_x, min_y), fill rule bias included
+    int w0_dx, w1_dx, w2_dx;         // increments when stepping one pixel to the right
+    int w0_dy, w1_dy, w2_dy;         // increments when stepping one row down
+    int w0_bias, w1_bias, w2_bias;   // fill rule bias: -1 moves pixels lying exactly on the edge outside
+    double inv_area;
+} edge_setup_t;
+
+///////////////////////////////////////////////////////////////////////////////
+// The edge functions of a block, relative to it so that they fit in 32-bit
+// lanes. An edge the whole block is inside of is replaced by a constant 0.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    int w0, w1, w2;          // edge functions at the first pixel
+    int w0_dx, w1_dx, w2_dx; // increments when stepping one pixel to the right
+} span_edges_t;
+
+// Counters filled in by the span kernels over a block
+typedef struct {
+    bool written;   // some pixel passed the depth test
+    int fragments;  // covered pixels that reached the depth test
+    int rejected;   // covered pixels that failed it
+} span_stats_t;
+
+// A value that is linear in screen space: origin at pixel (min_x, min_y), plus dx and dy per pixel
+typedef struct {
+    float origin, dx, dy;
+} attribute_t;
+
+static int64_t edge_function(int64_t ax, int64_t ay, int64_t bx, int64_t by, int64_t px, int64_t py) {
+    return (bx - ax) * (py - ay) - (by - ay) * (px - ax);
+}
+
+// With the inside on the positive side, a top edge goes right horizontally and a left edge goes up
+static int fill_rule_bias(int64_t ax, int64_t ay, int64_t bx, int64_t by) {
+    bool top_edge = ay == by && bx > ax;
+    bool left_edge = by < ay;
+    return (top_edge || left_edge) ? 0 : -1;
+}
+
+static int64_t floor_div(int64_t a, int64_t b) {
+    int64_t q = a / b;
+    return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+static int64_t ceil_div(int64_t a, int64_t b) {
+    return -floor_div(-a, b);
+}
+
+static attribute_t attribute_new(float v0, float v1, float v2, const edge_setup_t* e) {
+    double k0 = v0 * e->inv_area;
+    double k1 = v1 * e->inv_area;
+    double k2 = v2 * e->inv_area;
+
+    // The barycentric weights are the edge functions without the fill rule bias
+    attribute_t attribute = {
+        .origin = (e->w0_row - e->w0_bias) * k0 + (e->w1_row - e->w1_bias) * k1 + (e->w2_row - e->w2_bias) * k2,
+        .dx = e->w0_dx * k0 + e->w1_dx * k1 + e->w2_dx * k2,
+        .dy = e->w0_dy * k0 + e->w1_dy * k1 + e->w2_dy * k2
+    };
+    return attribute;
+}
+
+// Value of the attribute at pixel (origin_x + dx, origin_y + dy)
+static float attribute_step(const attribute_t* a, int dx, int dy) {
+    return a->origin + a->dx * dx + a->dy * dy;
+}
+
+static float attribute_at(const attribute_t* a, const edge_setup_t* e, int x, int y) {
+    return attribute_step(a, x - e->min_x, y - e->min_y);
+}
+
+static void point_swap(vec4_t* a, vec4_t* b) {
+    vec4_t tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+static void texcoord_swap(tex2_t* a, tex2_t* b) {
+    tex2_t tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+// Convert a screen coordinate to the fixed point grid of the raster method
+static int64_t snap_coordinate(float value, bool subpixel) {
+    return subpixel ? llroundf(value * SUBPIXEL_SCALE) : (int64_t)value;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Compute the bounding box and the edge equations of a triangle.
+// Clockwise triangles are flipped so the inside is always the positive side.
+// Returns false if the triangle is degenerate or covers no pixel sample of
+// the clip rectangle.
+///////////////////////////////////////////////////////////////////////////////
+static bool setup_edges(triangle_t* triangle, raster_rect_t clip, bool subpixel, edge_setup_t* edges) {
+    int64_t x0 = snap_coordinate(triangle->points[0].x, subpixel), y0 = snap_coordinate(triangle->points[0].y, subpixel);
+    int64_t x1 = snap_coordinate(triangle->points[1].x, subpixel), y1 = snap_coordinate(triangle->points[1].y, subpixel);
+    int64_t x2 = snap_coordinate(triangle->points[2].x, subpixel), y2 = snap_coordinate(triangle->points[2].y, subpixel);
+
+    int64_t area = edge_function(x0, y0, x1, y1, x2, y2);
+    if (area == 0) {
+        return false;
+    }
+    if (area < 0) {
+        int64_t tmp;
+        point_swap(&triangle->points[1], &triangle->points[2]);
+        texcoord_swap(&triangle->texcoords[1], &triangle->texcoords[2]);
+        tmp = x1; x1 = x2; x2 = tmp;
+        tmp = y1; y1 = y2; y2 = tmp;
+        area = -area;
+    }
+
+    // Pixel (x, y) is sampled at (x * scale + offset, y * scale + offset) on the fixed point grid
+    int64_t scale = subpixel ? SUBPIXEL_SCALE : 1;
+    int64_t offset = subpixel ? SUBPIXEL_SCALE / 2 : 0;
+
+    // Bounding box of the pixel samples covered by the triangle, clamped to the clip rectangle
+    int64_t min_x = ceil_div((x0 < x1 ? (x0 < x2 ? x0 : x2) : (x1 < x2 ? x1 : x2)) - offset, scale);
+    int64_t min_y = ceil_div((y0 < y1 ? (y0 < y2 ? y0 : y2) : (y1 < y2 ? y1 : y2)) - offset, scale);
+    int64_t max_x = floor_div((x0 > x1 ? (x0 > x2 ? x0 : x2) : (x1 > x2 ? x1 : x2)) - offset, scale);
+    int64_t max_y = floor_div((y0 > y1 ? (y0 > y2 ? y0 : y2) : (y1 > y2 ? y1 : y2)) - offset, scale);
+    if (min_x < clip.min_x) min_x = clip.min_x;
+    if (min_y < clip.min_y) min_y = clip.min_y;
+    if (max_x > clip.max_x) max_x = clip.max_x;
+    if (max_y > clip.max_y) max_y = clip.max_y;
+    if (min_x > max_x || min_y > max_y) {
+        return false;
+    }
+    edges->min_x = min_x;
+    edges->min_y = min_y;
+    edges->max_x = max_x;
+    edges->max_y = max_y;
+
+    // Only the sub-pixel method applies the top-left rule, the integer method keeps every edge inclusive
+    edges->w0_bias = subpixel ? fill_rule_bias(x1, y1, x2, y2) : 0;
+    edges->w1_bias = subpixel ? fill_rule_bias(x2, y2, x0, y0) : 0;
+    edges->w2_bias = subpixel ? fill_rule_bias(x0, y0, x1, y1) : 0;
+
+    // Edge functions of the edges opposite to v0, v1 and v2 at the first pixel of the box
+    int64_t px = min_x * scale + offset;
+    int64_t py = min_y * scale + offset;
+    edges->w0_row = edge_function(x1, y1, x2, y2, px, py) + edges->w0_bias;
+    edges->w1_row = edge_function(x2, y2, x0, y0, px, py) + edges->w1_bias;
+    edges->w2_row = edge_function(x0, y0, x1, y1, px, py) + edges->w2_bias;
+
+    // dE/dx = A.y - B.y and dE/dy = B.x - A.x, times the size of a pixel on the grid
+    edges->w0_dx = (y1 - y2) * scale;
+    edges->w1_dx = (y2 - y0) * scale;
+    edges->w2_dx = (y0 - y1) * scale;
+    edges->w0_dy = (x2 - x1) * scale;
+    edges->w1_dy = (x0 - x2) * scale;
+    edges->w2_dy = (x1 - x0) * scale;
+
+    edges->inv_area = 1.0 / area;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Everything the span kernels need to shade the pixels of one triangle
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    edge_setup_t edges;
+    attribute_t reciprocal_w;
+    attribute_t u_over_w;
+    attribute_t v_over_w;
+    float max_reciprocal_w;  // largest 1/w of the three vertices, i.e. the nearest depth
+    float depth_far;         // stored depth is depth_far - depth_scale / w, see encode_depth
+    float depth_scale;
+    uint32_t color;
+    uint32_t* target;  // buffer the filled kernels write color to: the color buffer or the visibility buffer
+    const texture_t* texture;
+} raster_triangle_t;
+
+static bool setup_triangle(triangle_t* triangle, raster_rect_t clip, raster_triangle_t* r) {
+    triangle_t t = *triangle;
+    if (!setup_edges(&t, clip, get_raster_method() == RASTER_SUBPIXEL, &r->edges)) {
+        return false;
+    }
+
+    // Flip the V component to account for inverted UV-coordinates (V grows downwards)
+    float v0 = 1.0 - t.texcoords[0].v;
+    float v1 = 1.0 - t.texcoords[1].v;
+    float v2 = 1.0 - t.texcoords[2].v;
+
+    // U/w, V/w and 1/w are linear in screen space, so they can be stepped like the edge functions
+    r->reciprocal_w = attribute_new(1 / t.points[0].w, 1 / t.points[1].w, 1 / t.points[2].w, &r->edges);
+    r->u_over_w = attribute_new(
+        t.texcoords[0].u / t.points[0].w, t.texcoords[1].u / t.points[1].w, t.texcoords[2].u / t.points[2].w, &r->edges
+    );
+    r->v_over_w = attribute_new(v0 / t.points[0].w, v1 / t.points[1].w, v2 / t.points[2].w, &r->edges);
+    r->max_reciprocal_w = fmaxf(1 / t.points[0].w, fmaxf(1 / t.points[1].w, 1 / t.points[2].w));
+    r->depth_far = get_depth_far();
+    r->depth_scale = get_depth_scale();
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Scalar span kernels: shade pixels x..x_end (inclusive) of row y, given the
+// local edge functions at the first pixel of the span. They return whether any
+// pixel passed the depth test.
+///////////////////////////////////////////////////////////////////////////////
+static void filled_span_scalar(const raster_triangle_t* r, int y, int x, int x_end, span_edges_t span, span_stats_t* stats) {
+    int window_width = get_window_width();
+    uint32_t* target_row = &r->target[window_width * y];
+    float* z_row = &z_buffer[window_width * y];
+
+    float interpolated_reciprocal_w = attribute_at(&r->reciprocal_w, &r->edges, x, y);
+
+    for (; x <= x_end; x++) {
+        // The pixel is inside when no edge function is negative
+        if ((span.w0 | span.w1 | span.w2) >= 0) {
+            // Adjust 1/w so the pixels that are closer to the camera have smaller values
+            float depth = r->depth_far - r->depth_scale * interpolated_reciprocal_w;
+            stats->fragments++;
+
+            if (depth < z_row[x]) {
+                target_row[x] = r->color;
+                z_row[x] = depth;
+                stats->written = true;
+            } else {
+                stats->rejected++;
+            }
+        }
+
+        span.w0 += span.w0_dx;
+        span.w1 += span.w1_dx;
+        span.w2 += span.w2_dx;
+        interpolated_reciprocal_w += r->reciprocal_w.dx;
+    }
+}
+
+static void textured_span_scalar(const raster_triangle_t* r, int y, int x, int x_end, span_edges_t span, span_stats_t* stats) {
+    int window_width = get_window_width();
+    uint32_t* color_row = &color_buffer[window_width * y];
+    float* z_row = &z_buffer[window_width * y];
+
+    float interpolated_reciprocal_w = attribute_at(&r->reciprocal_w, &r->edges, x, y);
+    float interpolated_u_over_w = attribute_at(&r->u_over_w, &r->edges, x, y);
+    float interpolated_v_over_w = attribute_at(&r->v_over_w, &r->edges, x, y);
+
+    for (; x <= x_end; x++) {
+        // The pixel is inside when no edge function is negative
+        if ((span.w0 | span.w1 | span.w2) >= 0) {
+            // Adjust 1/w so the pixels that are closer to the camera have smaller values
+            float depth = r->depth_far - r->depth_scale * interpolated_reciprocal_w;
+            stats->fragments++;
+
+            if (depth < z_row[x]) {
+                // Divide back by 1/w and map the UV coordinate to the full texture width and height
+                float u = interpolated_u_over_w / interpolated_reciprocal_w;
+                float v = interpolated_v_over_w / interpolated_reciprocal_w;
+                int tex_x = abs((int)(u * r->texture->width)) % r->texture->width;
+                int tex_y = abs((int)(v * r->texture->height)) % r->texture->height;
+
+                color_row[x] = r->texture->pixels[(r->texture->width * tex_y) + tex_x];
+                z_row[x] = depth;
+                stats->written = true;
+            } else {
+                stats->rejected++;
+            }
+        }
+
+        span.w0 += span.w0_dx;
+        span.w1 += span.w1_dx;
+        span.w2 += span.w2_dx;
+        interpolated_reciprocal_w += r->reciprocal_w.dx;
+        interpolated_u_over_w += r->u_over_w.dx;
+        interpolated_v_over_w += r->v_over_w.dx;
+    }
+}
+
+#if defined(__AVX2__)
+///////////////////////////////////////////////////////////////////////////////
+// AVX2 span kernels: 8 horizontally adjacent pixels per iteration.
+// Coverage, depth test, z-buffer store and texel fetch are all done on the
+// whole group with lane masks. They return the first pixel left for the
+// scalar kernels (the last width % 8 pixels of the span).
+///////////////////////////////////////////////////////////////////////////////
+#define SIMD_LANES 8
+
+// Return (int)a % n for a >= 0, clamped to [0, n - 1], computed in floats
+static inline __m256 wrap_texcoord_avx2(__m256 a, __m256 n, __m256 inv_n) {
+    a = _mm256_round_ps(a, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    __m256 q = _mm256_round_ps(_mm256_mul_ps(a, inv_n), _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    __m256 rem = _mm256_sub_ps(a, _mm256_mul_ps(q, n));
+    rem = _mm256_sub_ps(rem, _mm256_and_ps(_mm256_cmp_ps(rem, n, _CMP_GE_OQ), n));
+    rem = _mm256_add_ps(rem, _mm256_and_ps(_mm256_cmp_ps(rem, _mm256_setzero_ps(), _CMP_LT_OQ), n));
+    return _mm256_min_ps(_mm256_max_ps(rem, _mm256_setzero_ps()), _mm256_sub_ps(n, _mm256_set1_ps(1)));
+}
+
+static int filled_span_simd(const raster_triangle_t* r, int y, int x, int x_end, span_edges_t span, span_stats_t* stats) {
+    int window_width = get_window_width();
+    uint32_t* target_row = &r->target[window_width * y];
+    float* z_row = &z_buffer[window_width * y];
+
+    __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256 lanes_f = _mm256_cvtepi32_ps(lanes);
+    __m256i w0v = _mm256_add_epi32(_mm256_set1_epi32(span.w0), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(span.w0_dx)));
+    __m256i w1v = _mm256_add_epi32(_mm256_set1_epi32(span.w1), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(span.w1_dx)));
+    __m256i w2v = _mm256_add_epi32(_mm256_set1_epi32(span.w2), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(span.w2_dx)));
+    __m256 rw = _mm256_add_ps(
+        _mm256_set1_ps(attribute_at(&r->reciprocal_w, &r->edges, x, y)),
+        _mm256_mul_ps(lanes_f, _mm256_set1_ps(r->reciprocal_w.dx))
+    );
+
+    __m256i w0_step = _mm256_set1_epi32(span.w0_dx * SIMD_LANES);
+    __m256i w1_step = _mm256_set1_epi32(span.w1_dx * SIMD_LANES);
+    __m256i w2_step = _mm256_set1_epi32(span.w2_dx * SIMD_LANES);
+    __m256 rw_step = _mm256_set1_ps(r->reciprocal_w.dx * SIMD_LANES);
+    __m256i minus_one = _mm256_set1_epi32(-1);
+    __m256 depth_far = _mm256_set1_ps(r->depth_far);
+    __m256 depth_scale = _mm256_set1_ps(r->depth_scale);
+    __m256i color = _mm256_set1_epi32(r->color);
+
+    for (; x + SIMD_LANES - 1 <= x_end; x += SIMD_LANES) {
+        __m256i inside = _mm256_cmpgt_epi32(_mm256_or_si256(_mm256_or_si256(w0v, w1v), w2v), minus_one);
+        __m256 depth = _mm256_sub_ps(depth_far, _mm256_mul_ps(depth_scale, rw));
+        __m256 closer = _mm256_cmp_ps(depth, _mm256_loadu_ps(&z_row[x]), _CMP_LT_OQ);
+        __m256i mask = _mm256_and_si256(inside, _mm256_castps_si256(closer));
+        int covered = _mm256_movemask_ps(_mm256_castsi256_ps(inside));
+        int visible = _mm256_movemask_ps(_mm256_castsi256_ps(mask));
+        stats->fragments += __builtin_popcount(covered);
+        stats->rejected += __builtin_popcount(covered & ~visible);
+
+        if (visible) {
+            stats->written = true;
+            _mm256_maskstore_ps(&z_row[x], mask, depth);
+            _mm256_maskstore_epi32((int*)&target_row[x], mask, color);
+        }
+
+        w0v = _mm256_add_epi32(w0v, w0_step);
+        w1v = _mm256_add_epi32(w1v, w1_step);
+        w2v = _mm256_add_epi32(w2v, w2_step);
+        rw = _mm256_add_ps(rw, rw_step);
+    }
+    return x;
+}
+
+static int textured_span_simd(const raster_triangle_t* r, int y, int x, int x_end, span_edges_t span, span_stats_t* stats) {
+    int window_width = get_window_width();
+    uint32_t* color_row = &color_buffer[window_width * y];
+    float* z_row = &z_buffer[window_width * y];
+
+    __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256 lanes_f = _mm256_cvtepi32_ps(lanes);
+    __m256i w0v = _mm256_add_epi32(_mm256_set1_epi32(span.w0), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(span.w0_dx)));
+    __m256i w1v = _mm256_add_epi32(_mm256_set1_epi32(span.w1), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(span.w1_dx)));
+    __m256i w2v = _mm256_add_epi32(_mm256_set1_epi32(span.w2), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(span.w2_dx)));
+    __m256 rw = _mm256_add_ps(
+        _mm256_set1_ps(attribute_at(&r->reciprocal_w, &r->edges, x, y)),
+        _mm256_mul_ps(lanes_f, _mm256_set1_ps(r->reciprocal_w.dx))
+    );
+    __m256 uw = _mm256_add_ps(
+        _mm256_set1_ps(attribute_at(&r->u_over_w, &r->edges, x, y)),
+        _mm256_mul_ps(lanes_f, _mm256_set1_ps(r->u_over_w.dx))
+    );
+    __m256 vw = _mm256_add_ps(
+        _mm256_set1_ps(attribute_at(&r->v_over_w, &r->edges, x, y)),
+        _mm256_mul_ps(lanes_f, _mm256_set1_ps(r->v_over_w.dx))
+    );
+
+    __m256i w0_step = _mm256_set1_epi32(span.w0_dx * SIMD_LANES);
+    __m256i w1_step = _mm256_set1_epi32(span.w1_dx * SIMD_LANES);
+    __m256i w2_step = _mm256_set1_epi32(span.w2_dx * SIMD_LANES);
+    __m256 rw_step = _mm256_set1_ps(r->reciprocal_w.dx * SIMD_LANES);
+    __m256 uw_step = _mm256_set1_ps(r->u_over_w.dx * SIMD_LANES);
+    __m256 vw_step = _mm256_set1_ps(r->v_over_w.dx * SIMD_LANES);
+    __m256i minus_one = _mm256_set1_epi32(-1);
+    __m256 depth_far = _mm256_set1_ps(r->depth_far);
+    __m256 depth_scale = _mm256_set1_ps(r->depth_scale);
+    __m256 sign_bit = _mm256_set1_ps(-0.0f);
+    __m256 tex_w = _mm256_set1_ps(r->texture->width);
+    __m256 tex_h = _mm256_set1_ps(r->texture->height);
+    __m256 inv_tex_w = _mm256_set1_ps(1.0f / r->texture->width);
+    __m256 inv_tex_h = _mm256_set1_ps(1.0f / r->texture->height);
+
+    for (; x + SIMD_LANES - 1 <= x_end; x += SIMD_LANES) {
+        __m256i inside = _mm256_cmpgt_epi32(_mm256_or_si256(_mm256_or_si256(w0v, w1v), w2v), minus_one);
+        __m256 depth = _mm256_sub_ps(depth_far, _mm256_mul_ps(depth_scale, rw));
+        __m256 closer = _mm256_cmp_ps(depth, _mm256_loadu_ps(&z_row[x]), _CMP_LT_OQ);
+        __m256i mask = _mm256_and_si256(inside, _mm256_castps_si256(closer));
+        int covered = _mm256_movemask_ps(_mm256_castsi256_ps(inside));
+        int visible = _mm256_movemask_ps(_mm256_castsi256_ps(mask));
+        stats->fragments += __builtin_popcount(covered);
+        stats->rejected += __builtin_popcount(covered & ~visible);
+
+        if (visible) {
+            stats->written = true;
+            // Divide back by 1/w and map |UV| to texel coordinates wrapped to the texture size
+            __m256 u = _mm256_div_ps(uw, rw);
+            __m256 v = _mm256_div_ps(vw, rw);
+            __m256 tex_x = wrap_texcoord_avx2(_mm256_andnot_ps(sign_bit, _mm256_mul_ps(u, tex_w)), tex_w, inv_tex_w);
+            __m256 tex_y = wrap_texcoord_avx2(_mm256_andnot_ps(sign_bit, _mm256_mul_ps(v, tex_h)), tex_h, inv_tex_h);
+            __m256i index = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(tex_y, tex_w), tex_x));
+
+            // Only the lanes that passed the depth test fetch their texel
+            __m256i texels = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int*)r->texture->pixels, index, mask, 4);
+
+            _mm256_maskstore_ps(&z_row[x], mask, depth);
+            _mm256_maskstore_epi32((int*)&color_row[x], mask, texels);
+        }
+
+        w0v = _mm256_add_epi32(w0v, w0_step);
+        w1v = _mm256_add_epi32(w1v, w1_step);
+        w2v = _mm256_add_epi32(w2v, w2_step);
+        rw = _mm256_add_ps(rw, rw_step);
+        uw = _mm256_add_ps(uw, uw_step);
+        vw = _mm256_add_ps(vw, vw_step);
+    }
+    return x;
+}
+
+#elif defined(__SSE2__)
+///////////////////////////////////////////////////////////////////////////////
+// SSE2 span kernels: 4 horizontally adjacent pixels per iteration.
+// SSE2 has no masked stores or gathers, so stores are blended with the old
+// values and the texels of the visible lanes are fetched one by one.
+// They return the first pixel left for the scalar kernels.
+///////////////////////////////////////////////////////////////////////////////
+#define SIMD_LANES 4
+
+static inline __m128 blend_sse2(__m128 old_value, __m128 new_value, __m128 mask) {
+    return _mm_or_ps(_mm_and_ps(mask, new_value), _mm_andnot_ps(mask, old_value));
+}
+
+// Return (int)a % n for a >= 0, clamped to [0, n - 1], computed in floats
+static inline __m128 wrap_texcoord_sse2(__m128 a, __m128 n, __m128 inv_n) {
+    a = _mm_cvtepi32_ps(_mm_cvttps_epi32(a));
+    __m128 q = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_mul_ps(a, inv_n)));
+    __m128 rem = _mm_sub_ps(a, _mm_mul_ps(q, n));
+    rem = _mm_sub_ps(rem, _mm_and_ps(_mm_cmpge_ps(rem, n), n));
+    rem = _mm_add_ps(rem, _mm_and_ps(_mm_cmplt_ps(rem, _mm_setzero_ps()), n));
+    return _mm_min_ps(_mm_max_ps(rem, _mm_setzero_ps()), _mm_sub_ps(n, _mm_set1_ps(1)));
+}
+
+static int filled_span_simd(const raster_triangle_t* r, int y, int x, int x_end, span_edges_t span, span_stats_t* stats) {
+    int window_width = get_window_width();
+    uint32_t* target_row = &r->target[window_width * y];
+    float* z_row = &z_buffer[window_width * y];
+
+    __m128i w0v = _mm_setr_epi32(span.w0, span.w0 + span.w0_dx, span.w0 + 2 * span.w0_dx, span.w0 + 3 * span.w0_dx);
+    __m128i w1v = _mm_setr_epi32(span.w1, span.w1 + span.w1_dx, span.w1 + 2 * span.w1_dx, span.w1 + 3 * span.w1_dx);
+    __m128i w2v = _mm_setr_epi32(span.w2, span.w2 + span.w2_dx, span.w2 + 2 * span.w2_dx, span.w2 + 3 * span.w2_dx);
+    __m128 lanes_f = _mm_setr_ps(0, 1, 2, 3);
+    __m128 rw = _mm_add_ps(
+        _mm_set1_ps(attribute_at(&r->reciprocal_w, &r->edges, x, y)),
+        _mm_mul_ps(lanes_f, _mm_set1_ps(r->reciprocal_w.dx))
+    );
+
+    __m128i w0_step = _mm_set1_epi32(span.w0_dx * SIMD_LANES);
+    __m128i w1_step = _mm_set1_epi32(span.w1_dx * SIMD_LANES);
+    __m128i w2_step = _mm_set1_epi32(span.w2_dx * SIMD_LANES);
+    __m128 rw_step = _mm_set1_ps(r->reciprocal_w.dx * SIMD_LANES);
+    __m128i minus_one = _mm_set1_epi32(-1);
+    __m128 depth_far = _mm_set1_ps(r->depth_far);
+    __m128 depth_scale = _mm_set1_ps(r->depth_scale);
+    __m128 color = _mm_castsi128_ps(_mm_set1_epi32(r->color));
+
+    for (; x + SIMD_LANES - 1 <= x_end; x += SIMD_LANES) {
+        __m128 inside = _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_or_si128(_mm_or_si128(w0v, w1v), w2v), minus_one));
+        __m128 depth = _mm_sub_ps(depth_far, _mm_mul_ps(depth_scale, rw));
+        __m128 z_old = _mm_loadu_ps(&z_row[x]);
+        __m128 mask = _mm_and_ps(inside, _mm_cmplt_ps(depth, z_old));
+        int covered = _mm_movemask_ps(inside);
+        int visible = _mm_movemask_ps(mask);
+        stats->fragments += __builtin_popcount(covered);
+        stats->rejected += __builtin_popcount(covered & ~visible);
+
+        if (visible) {
+            stats->written = true;
+            __m128 target_old = _mm_loadu_ps((float*)&target_row[x]);
+            _mm_storeu_ps(&z_row[x], blend_sse2(z_old, depth, mask));
+            _mm_storeu_ps((float*)&target_row[x], blend_sse2(target_old, color, mask));
+        }
+
+        w0v = _mm_add_epi32(w0v, w0_step);
+        w1v = _mm_add_epi32(w1v, w1_step);
+        w2v = _mm_add_epi32(w2v, w2_step);
+        rw = _mm_add_ps(rw, rw_step);
+    }
+    return x;
+}
+
+static int textured_span_simd(const raster_triangle_t* r, int y, int x, int x_end, span_edges_t span, span_stats_t* stats) {
+    int window_width = get_window_width();
+    uint32_t* color_row = &color_buffer[window_width * y];
+    float* z_row = &z_buffer[window_width * y];
+
+    __m128i w0v = _mm_setr_epi32(span.w0, span.w0 + span.w0_dx, span.w0 + 2 * span.w0_dx, span.w0 + 3 * span.w0_dx);
+    __m128i w1v = _mm_setr_epi32(span.w1, span.w1 + span.w1_dx, span.w1 + 2 * span.w1_dx, span.w1 + 3 * span.w1_dx);
+    __m128i w2v = _mm_setr_epi32(span.w2, span.w2 + span.w2_dx, span.w2 + 2 * span.w2_dx, span.w2 + 3 * span.w2_dx);
+    __m128 lanes_f = _mm_setr_ps(0, 1, 2, 3);
+    __m128 rw = _mm_add_ps(
+        _mm_set1_ps(attribute_at(&r->reciprocal_w, &r->edges, x, y)),
+        _mm_mul_ps(lanes_f, _mm_set1_ps(r->reciprocal_w.dx))
+    );
+    __m128 uw = _mm_add_ps(
+        _mm_set1_ps(attribute_at(&r->u_over_w, &r->edges, x, y)),
+        _mm_mul_ps(lanes_f, _mm_set1_ps(r->u_over_w.dx))
+    );
+    __m128 vw = _mm_add_ps(
+        _mm_set1_ps(attribute_at(&r->v_over_w, &r->edges, x, y)),
+        _mm_mul_ps(lanes_f, _mm_set1_ps(r->v_over_w.dx))
+    );
+
+    __m128i w0_step = _mm_set1_epi32(span.w0_dx * SIMD_LANES);
+    __m128i w1_step = _mm_set1_epi32(span.w1_dx * SIMD_LANES);
+    __m128i w2_step = _mm_set1_epi32(span.w2_dx * SIMD_LANES);
+    __m128 rw_step = _mm_set1_ps(r->reciprocal_w.dx * SIMD_LANES);
+    __m128 uw_step = _mm_set1_ps(r->u_over_w.dx * SIMD_LANES);
+    __m128 vw_step = _mm_set1_ps(r->v_over_w.dx * SIMD_LANES);
+    __m128i minus_one = _mm_set1_epi32(-1);
+    __m128 depth_far = _mm_set1_ps(r->depth_far);
+    __m128 depth_scale = _mm_set1_ps(r->depth_scale);
+    __m128 sign_bit = _mm_set1_ps(-0.0f);
+    __m128 tex_w = _mm_set1_ps(r->texture->width);
+    __m128 tex_h = _mm_set1_ps(r->texture->height);
+    __m128 inv_tex_w = _mm_set1_ps(1.0f / r->texture->width);
+    __m128 inv_tex_h = _mm_set1_ps(1.0f / r->texture->height);
+
+    for (; x + SIMD_LANES - 1 <= x_end; x += SIMD_LANES) {
+        __m128 inside = _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_or_si128(_mm_or_si128(w0v, w1v), w2v), minus_one));
+        __m128 depth = _mm_sub_ps(depth_far, _mm_mul_ps(depth_scale, rw));
+        __m128 z_old = _mm_loadu_ps(&z_row[x]);
+        __m128 mask = _mm_and_ps(inside, _mm_cmplt_ps(depth, z_old));
+        int covered = _mm_movemask_ps(inside);
+        int visible = _mm_movemask_ps(mask);
+        stats->fragments += __builtin_popcount(covered);
+        stats->rejected += __builtin_popcount(covered & ~visible);
+
+        if (visible) {
+            stats->written = true;
+            // Divide back by 1/w and map |UV| to texel coordinates wrapped to the texture size
+            __m128 u = _mm_div_ps(uw, rw);
+            __m128 v = _mm_div_ps(vw, rw);
+            __m128 tex_x = wrap_texcoord_sse2(_mm_andnot_ps(sign_bit, _mm_mul_ps(u, tex_w)), tex_w, inv_tex_w);
+            __m128 tex_y = wrap_texcoord_sse2(_mm_andnot_ps(sign_bit, _mm_mul_ps(v, tex_h)), tex_h, inv_tex_h);
+
+            // Emulate the gather: only the lanes that passed the depth test fetch their texel
+            int32_t index[SIMD_LANES];
+            uint32_t texels[SIMD_LANES];
+            _mm_storeu_si128((__m128i*)index, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(tex_y, tex_w), tex_x)));
+            for (int lane = 0; lane < SIMD_LANES; lane++) {
+                texels[lane] = (visible & (1 << lane)) ? r->texture->pixels[index[lane]] : 0;
+            }
+
+            __m128 color_old = _mm_loadu_ps((float*)&color_row[x]);
+            _mm_storeu_ps(&z_row[x], blend_sse2(z_old, depth, mask));
+            _mm_storeu_ps((float*)&color_row[x], blend_sse2(color_old, _mm_loadu_ps((float*)texels), mask));
+        }
+
+        w0v = _mm_add_epi32(w0v, w0_step);
+        w1v = _mm_add_epi32(w1v, w1_step);
+        w2v = _mm_add_epi32(w2v, w2_step);
+        rw = _mm_add_ps(rw, rw_step);
+        uw = _mm_add_ps(uw, uw_step);
+        vw = _mm_add_ps(vw, vw_step);
+    }
+    return x;
+}
+#endif
+
+// Largest value of a linear function over a w x h rectangle, given its value at
+// the top-left corner and its increments along x and y
+static float max_over_rect(float value, float dx, float dy, int w, int h) {
+    return value + (dx > 0 ? dx * w : 0) + (dy > 0 ? dy * h : 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Reduce an edge function to values local to a w x h block. Returns false if
+// every pixel of the block is outside the edge. If every pixel is inside, the
+// edge is replaced by a constant 0 so it never rejects a pixel. Otherwise the
+// value at the first pixel is within w * |dx| + h * |dy| of zero and fits in
+// 32 bits.
+///////////////////////////////////////////////////////////////////////////////
+static bool block_edge(int64_t w, int dx, int dy, int width, int height, int* local_w, int* local_dx, int* local_dy) {
+    int64_t max_w = w + (dx > 0 ? (int64_t)dx * width : 0) + (dy > 0 ? (int64_t)dy * height : 0);
+    int64_t min_w = w + (dx < 0 ? (int64_t)dx * width : 0) + (dy < 0 ? (int64_t)dy * height : 0);
+    if (max_w < 0) {
+        return false;
+    }
+    if (min_w >= 0) {
+        *local_w = *local_dx = *local_dy = 0;
+    } else {
+        *local_w = (int)w;
+        *local_dx = dx;
+        *local_dy = dy;
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Walk the bounding box in HIZ_BLOCK_SIZE x HIZ_BLOCK_SIZE blocks aligned with
+// the hierarchical z-buffer. Before any per-pixel work, a block is skipped if
+// it lies completely outside one of the edges, or if the nearest depth the
+// triangle can reach inside it is not closer than the farthest depth already
+// stored in the block. Visible blocks are shaded row by row with the vector
+// kernel first (when compiled in), finishing the remaining pixels with the
+// scalar kernel, and their coarse depth is refreshed afterwards.
+///////////////////////////////////////////////////////////////////////////////
+static void rasterize_blocks(const raster_triangle_t* r, bool textured) {
+    const edge_setup_t* e = &r->edges;
+    bool hiz_culling = get_hiz_culling();
+
+    // Counted locally and published once per triangle
+    int fragments = 0;
+    int rejected = 0;
+    int hiz_rejected = 0;
+
+    for (int block_y = e->min_y / HIZ_BLOCK_SIZE * HIZ_BLOCK_SIZE; block_y <= e->max_y; block_y += HIZ_BLOCK_SIZE) {
+        int y0 = block_y < e->min_y ? e->min_y : block_y;
+        int y1 = block_y + HIZ_BLOCK_SIZE - 1 > e->max_y ? e->max_y : block_y + HIZ_BLOCK_SIZE - 1;
+
+        for (int block_x = e->min_x / HIZ_BLOCK_SIZE * HIZ_BLOCK_SIZE; block_x <= e->max_x; block_x += HIZ_BLOCK_SIZE) {
+            int x0 = block_x < e->min_x ? e->min_x : block_x;
+            int x1 = block_x + HIZ_BLOCK_SIZE - 1 > e->max_x ? e->max_x : block_x + HIZ_BLOCK_SIZE - 1;
+
+            // Edge functions at the top-left pixel of the block
+            int64_t w0 = e->w0_row + (int64_t)(x0 - e->min_x) * e->w0_dx + (int64_t)(y0 - e->min_y) * e->w0_dy;
+            int64_t w1 = e->w1_row + (int64_t)(x0 - e->min_x) * e->w1_dx + (int64_t)(y0 - e->min_y) * e->w1_dy;
+            int64_t w2 = e->w2_row + (int64_t)(x0 - e->min_x) * e->w2_dx + (int64_t)(y0 - e->min_y) * e->w2_dy;
+
+            // Trivial reject: the block is entirely on the outer side of an edge
+            span_edges_t row;
+            int w0_dy, w1_dy, w2_dy;
+            if (!block_edge(w0, e->w0_dx, e->w0_dy, x1 - x0, y1 - y0, &row.w0, &row.w0_dx, &w0_dy) ||
+                !block_edge(w1, e->w1_dx, e->w1_dy, x1 - x0, y1 - y0, &row.w1, &row.w1_dx, &w1_dy) ||
+                !block_edge(w2, e->w2_dx, e->w2_dy, x1 - x0, y1 - y0, &row.w2, &row.w2_dx, &w2_dy)) {
+                continue;
+            }
+
+            // Occlusion reject: the closest point of the triangle in the block is behind everything in it
+            float* block_depth = &hiz_buffer[(block_y / HIZ_BLOCK_SIZE) * get_hiz_width() + block_x / HIZ_BLOCK_SIZE];
+            if (hiz_culling) {
+                float nearest_reciprocal_w = fminf(
+                    max_over_rect(
+                        attribute_at(&r->reciprocal_w, e, x0, y0), r->reciprocal_w.dx, r->reciprocal_w.dy, x1 - x0, y1 - y0
+                    ),
+                    r->max_reciprocal_w
+                );
+                if (r->depth_far - r->depth_scale * nearest_reciprocal_w >= *block_depth) {
+                    hiz_rejected++;
+                    continue;
+                }
+            }
+
+            span_stats_t stats = { false, 0, 0 };
+            for (int y = y0; y <= y1; y++) {
+                int x = x0;
+#ifdef SIMD_LANES
+                if (textured) {
+                    x = textured_span_simd(r, y, x, x1, row, &stats);
+                } else {
+                    x = filled_span_simd(r, y, x, x1, row, &stats);
+                }
+#endif
+                // Edge functions at the first pixel left for the scalar kernel
+                span_edges_t rest = row;
+                rest.w0 += (x - x0) * row.w0_dx;
+                rest.w1 += (x - x0) * row.w1_dx;
+                rest.w2 += (x - x0) * row.w2_dx;
+
+                if (textured) {
+                    textured_span_scalar(r, y, x, x1, rest, &stats);
+                } else {
+                    filled_span_scalar(r, y, x, x1, rest, &stats);
+                }
+
+                row.w0 += w0_dy;
+                row.w1 += w1_dy;
+                row.w2 += w2_dy;
+            }
+
+            if (stats.written) {
+                update_hiz_block(block_x / HIZ_BLOCK_SIZE, block_y / HIZ_BLOCK_SIZE);
+            }
+            fragments += stats.fragments;
+            rejected += stats.rejected;
+        }
+    }
+
+    add_depth_test_stats(fragments, rejected);
+    add_hiz_rejected_blocks(hiz_rejected);
+}
+
+raster_rect_t raster_screen_rect(void) {
+    raster_rect_t rect = { 0, 0, get_window_width() - 1, get_window_height() - 1 };
+    return rect;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw a solid triangle testing every pixel of its bounding box against the
+// three edge functions, with depth from the interpolated 1/w.
+// Only the pixels inside the clip rectangle are touched.
+///////////////////////////////////////////////////////////////////////////////
+void rasterize_filled_triangle(triangle_t* triangle, uint32_t color, raster_rect_t clip) {
+    raster_triangle_t r;
+    if (!setup_triangle(triangle, clip, &r)) {
+        return;
+    }
+    r.color = color;
+    r.target = color_buffer;
+    rasterize_blocks(&r, false);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw a textured triangle testing every pixel of its bounding box against the
+// three edge functions, with perspective-correct coordinates into the texture
+// of the triangle. Only the pixels inside the clip rectangle are touched.
+///////////////////////////////////////////////////////////////////////////////
+void rasterize_textured_triangle(triangle_t* triangle, raster_rect_t clip) {
+    raster_triangle_t r;
+    if (!setup_triangle(triangle, clip, &r)) {
+        return;
+    }
+    r.texture = triangle->texture;
+    rasterize_blocks(&r, true);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Deferred texturing
+///////////////////////////////////////////////////////////////////////////////
+// The visibility pass runs the filled kernels with the index of the triangle
+// as its "color" and the visibility buffer as target, so the depth test
+// leaves the index of the nearest triangle at every covered pixel without
+// computing any UV. The resolve pass then shades each covered pixel once,
+// from the perspective-correct planes of the triangle that won it:
+//
+//   pass 1:  z_buffer + visibility_buffer  <-  depth, triangle index
+//   pass 2:  color_buffer  <-  texture(u/w / 1/w, v/w / 1/w) of planes[index]
+///////////////////////////////////////////////////////////////////////////////
+
+// The shading planes of a triangle, with the pixel their origin is relative to
+typedef struct {
+    attribute_t reciprocal_w;
+    attribute_t u_over_w;
+    attribute_t v_over_w;
+    int origin_x, origin_y;
+    const texture_t* texture;
+} shading_planes_t;
+
+// Shading planes of the triangles of the frame, in the frame arena
+static shading_planes_t* visibility_planes = NULL;
+
+void rasterize_visibility_triangle(triangle_t* triangle, uint32_t triangle_index, raster_rect_t clip) {
+    raster_triangle_t r;
+    if (!setup_triangle(triangle, clip, &r)) {
+        return;
+    }
+    r.color = triangle_index;
+    r.target = visibility_buffer;
+    rasterize_blocks(&r, false);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Set up the shading planes of every triangle of the frame, indexed like the
+// triangle indices stored in the visibility buffer. Must be called before
+// resolve_visibility, with the same array of triangles, and the planes stay
+// valid until the arena is reset.
+///////////////////////////////////////////////////////////////////////////////
+void setup_visibility_triangles(triangle_t* triangles, int num_triangles, arena_t* arena) {
+    visibility_planes = (shading_planes_t*)arena_alloc(arena, sizeof(shading_planes_t) * (num_triangles ? num_triangles : 1));
+
+    for (int i = 0; i < num_triangles; i++) {
+        raster_triangle_t r;
+        // Triangles that fail the setup cover no pixel, so their planes are never read
+        if (!setup_triangle(&triangles[i], raster_screen_rect(), &r)) {
+            continue;
+        }
+        shading_planes_t* planes = &visibility_planes[i];
+        planes->reciprocal_w = r.reciprocal_w;
+        planes->u_over_w = r.u_over_w;
+        planes->v_over_w = r.v_over_w;
+        planes->origin_x = r.edges.min_x;
+        planes->origin_y = r.edges.min_y;
+        planes->texture = triangles[i].texture;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Shade every pixel of the rectangle covered by the visibility pass: a pixel
+// is covered when its depth was written this frame (it is below the depths
+// of every earlier epoch). Each visible pixel computes its UV and fetches its texel
+// exactly once, from the texture of the triangle that won it.
+///////////////////////////////////////////////////////////////////////////////
+void resolve_visibility(raster_rect_t rect) {
+    int window_width = get_window_width();
+    float depth_far = get_depth_far();
+
+    for (int y = rect.min_y; y <= rect.max_y; y++) {
+        uint32_t* color_row = &color_buffer[window_width * y];
+        float* z_row = &z_buffer[window_width * y];
+        uint32_t* visibility_row = &visibility_buffer[window_width * y];
+
+        for (int x = rect.min_x; x <= rect.max_x; x++) {
+            if (z_row[x] >= depth_far) {
+                continue;
+            }
+            const shading_planes_t* planes = &visibility_planes[visibility_row[x]];
+            int dx = x - planes->origin_x;
+            int dy = y - planes->origin_y;
+
+            // Divide back by 1/w and map the UV coordinate to the full texture width and height
+            float reciprocal_w = attribute_step(&planes->reciprocal_w, dx, dy);
+            float u = attribute_step(&planes->u_over_w, dx, dy) / reciprocal_w;
+            float v = attribute_step(&planes->v_over_w, dx, dy) / reciprocal_w;
+            const texture_t* texture = planes->texture;
+            int tex_x = abs((int)(u * texture->width)) % texture->width;
+            int tex_y = abs((int)(v * texture->height)) % texture->height;
+
+            color_row[x] = texture->pixels[(texture->width * tex_y) + tex_x];
+        }
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef RASTERIZER_H
+#define RASTERIZER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "arena.h"
+#include "triangle.h"
+
+// Inclusive pixel rectangle the rasterizer is allowed to write to
+typedef struct {
+    int min_x, min_y, max_x, max_y;
+} raster_rect_t;
+
+raster_rect_t raster_screen_rect(void);
+
+void rasterize_filled_triangle(triangle_t* triangle, uint32_t color, raster_rect_t clip);
+void rasterize_textured_triangle(triangle_t* triangle, raster_rect_t clip);
+
+void rasterize_visibility_triangle(triangle_t* triangle, uint32_t triangle_index, raster_rect_t clip);
+void setup_visibility_triangles(triangle_t* triangles, int num_triangles, arena_t* arena);
+void resolve_visibility(raster_rect_t rect);
+
+#endif
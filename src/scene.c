@@ -0,0 +1,165 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "array.h"
+#include "scene.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Scene
+///////////////////////////////////////////////////////////////////////////////
+// The scene is a flat list of instances. Meshes and textures are loaded
+// through their registries, so a file is read once however many instances
+// show it, and an instance costs only its transform:
+//
+//   instances:  [ drone, t0 ] [ drone, t1 ] [ crab, t2 ] [ drone, t3 ]
+//                     \            |             |            /
+//   meshes:            drone.obj --+----------   crab.obj
+//
+// A scene file describes one instance per line, blank lines and lines
+// starting with '#' aside:
+//
+//   mesh.obj texture.png x y z [scale [spin_x spin_y spin_z]]
+///////////////////////////////////////////////////////////////////////////////
+
+static instance_t* instances = NULL;
+
+bool add_instance(char* mesh_filename, char* texture_filename, vec3_t translation, float scale, vec3_t spin) {
+    instance_t instance = {
+        .mesh = load_mesh(mesh_filename),
+        .texture = load_png_texture(texture_filename),
+        .scale = { scale, scale, scale },
+        .rotation = { 0, 0, 0 },
+        .translation = translation,
+        .spin = spin
+    };
+    if (instance.mesh == NULL || instance.texture == NULL) {
+        return false;
+    }
+    array_push(instances, instance);
+    return true;
+}
+
+bool load_scene_file(char* filename) {
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Cannot read scene %s\n", filename);
+        return false;
+    }
+
+    char line[1024];
+    int line_number = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file)) {
+        line_number++;
+        char mesh_filename[512];
+        char texture_filename[512];
+        vec3_t translation;
+        float scale = 1.0;
+        vec3_t spin = { 0, 0, 0 };
+
+        char first[2];
+        if (sscanf(line, " %1s", first) != 1 || first[0] == '#') {
+            continue;
+        }
+        int fields = sscanf(
+            line, "%511s %511s %f %f %f %f %f %f %f",
+            mesh_filename, texture_filename, &translation.x, &translation.y, &translation.z,
+            &scale, &spin.x, &spin.y, &spin.z
+        );
+        if (fields != 5 && fields != 6 && fields != 9) {
+            fprintf(stderr, "%s:%d: expected \"mesh texture x y z [scale [spin_x spin_y spin_z]]\"\n", filename, line_number);
+            ok = false;
+        } else {
+            ok = add_instance(mesh_filename, texture_filename, translation, scale, spin);
+        }
+    }
+    fclose(file);
+
+    if (ok && array_length(instances) == 0) {
+        fprintf(stderr, "Scene %s has no objects\n", filename);
+        ok = false;
+    }
+    return ok;
+}
+
+void free_scene(void) {
+    array_free(instances);
+    instances = NULL;
+    free_meshes();
+    free_textures();
+}
+
+int get_num_instances(void) {
+    return array_length(instances);
+}
+
+instance_t* get_instance(int index) {
+    return &instances[index];
+}
+
+// Vertices of the largest mesh, to size the buffers the instances take turns to use
+int get_scene_max_vertices(void) {
+    int max_vertices = 0;
+    for (size_t i = 0; i < array_length(instances); i++) {
+        if (instances[i].mesh->positions.count > max_vertices) {
+            max_vertices = instances[i].mesh->positions.count;
+        }
+    }
+    return max_vertices;
+}
+
+void update_scene(float delta_time) {
+    for (size_t i = 0; i < array_length(instances); i++) {
+        instances[i].rotation = vec3_add(instances[i].rotation, vec3_mul(instances[i].spin, delta_time));
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// World matrix of an instance. Order matters: first scale, then rotate, then
+// translate. [T]*[R]*[S]*v
+///////////////////////////////////////////////////////////////////////////////
+mat4_t instance_world_matrix(const instance_t* instance) {
+    mat4_t scale_matrix = mat4_make_scale(instance->scale.x, instance->scale.y, instance->scale.z);
+    mat4_t translation_matrix = mat4_make_translation(
+        instance->translation.x, instance->translation.y, instance->translation.z
+    );
+    mat4_t rotation_matrix_x = mat4_make_rotation_x(instance->rotation.x);
+    mat4_t rotation_matrix_y = mat4_make_rotation_y(instance->rotation.y);
+    mat4_t rotation_matrix_z = mat4_make_rotation_z(instance->rotation.z);
+
+    mat4_t world_matrix = mat4_identity();
+    world_matrix = mat4_mul_mat4(scale_matrix, world_matrix);
+    world_matrix = mat4_mul_mat4(rotation_matrix_z, world_matrix);
+    world_matrix = mat4_mul_mat4(rotation_matrix_y, world_matrix);
+    world_matrix = mat4_mul_mat4(rotation_matrix_x, world_matrix);
+    world_matrix = mat4_mul_mat4(translation_matrix, world_matrix);
+    return world_matrix;
+}
+
+// Largest scale factor of an instance, by which its bounding spheres grow
+float instance_max_scale(const instance_t* instance) {
+    return fmaxf(fabsf(instance->scale.x), fmaxf(fabsf(instance->scale.y), fabsf(instance->scale.z)));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Test the bounds of the mesh of an instance against the frustum, before any
+// of its vertices is transformed. The box corners are carried to camera space
+// by the model-view matrix, so the test is on the box as rotated with the
+// object, not on a box around it.
+///////////////////////////////////////////////////////////////////////////////
+frustum_test_t instance_frustum_test(const instance_t* instance, const mat4_t* model_view) {
+    const mesh_t* mesh = instance->mesh;
+    vec3_t center = vec3_from_vec4(mat4_mul_vec4(*model_view, vec4_from_vec3(mesh->bounds_center)));
+    float radius = mesh->bounds_radius * instance_max_scale(instance);
+
+    vec3_t corners[8];
+    for (int k = 0; k < 8; k++) {
+        vec3_t corner = {
+            (k & 1) ? mesh->bounds_max.x : mesh->bounds_min.x,
+            (k & 2) ? mesh->bounds_max.y : mesh->bounds_min.y,
+            (k & 4) ? mesh->bounds_max.z : mesh->bounds_min.z
+        };
+        corners[k] = vec3_from_vec4(mat4_mul_vec4(*model_view, vec4_from_vec3(corner)));
+    }
+    return classify_bounds_in_frustum(center, radius, corners);
+}
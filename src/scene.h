@@ -0,0 +1,37 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <stdbool.h>
+#include "clipping.h"
+#include "matrix.h"
+#include "mesh.h"
+#include "texture.h"
+#include "vector.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// An object of the scene: a mesh and a texture, shared with every other
+// instance of the same files, placed in the world by its own transform.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    mesh_t* mesh;
+    texture_t* texture;
+    vec3_t scale;
+    vec3_t rotation;
+    vec3_t translation;
+    vec3_t spin;  // radians per second added to the rotation every frame
+} instance_t;
+
+bool add_instance(char* mesh_filename, char* texture_filename, vec3_t translation, float scale, vec3_t spin);
+bool load_scene_file(char* filename);
+void free_scene(void);
+
+int get_num_instances(void);
+instance_t* get_instance(int index);
+int get_scene_max_vertices(void);
+
+void update_scene(float delta_time);
+mat4_t instance_world_matrix(const instance_t* instance);
+float instance_max_scale(const instance_t* instance);
+frustum_test_t instance_frustum_test(const instance_t* instance, const mat4_t* model_view);
+
+#endif
@@ -0,0 +1,496 @@
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "array.h"
+#include "mesh_optimize.h"
+#include "simplify.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Mesh simplification and levels of detail
+///////////////////////////////////////////////////////////////////////////////
+// The levels are built one from the other by edge collapses ranked with
+// quadric error metrics (Garland and Heckbert). Every vertex carries the
+// area-weighted sum of the squared distances to the planes of its faces; a
+// collapse moves a vertex onto a neighbour, and costs the mean squared
+// distance of the neighbour to the planes of both. The quadric of a vertex
+// is added to its neighbour when it collapses, so the error of a level is
+// measured against the faces of the full mesh.
+//
+// Collapses only move vertices onto existing vertices, so every level reuses
+// the vertex arrays of the full mesh and only adds indices. A UV seam is a
+// run of positions shared by two vertices with different UVs, one on each
+// side. A seam vertex only collapses along the seam, together with its twin
+// on the other side, so both sides keep matching positions and the texture
+// does not tear. Vertices on an open border, and positions shared by more
+// than two vertices, never move.
+//
+// Each pass picks the cheapest collapse of every vertex that does not flip a
+// face, and applies them cheapest first. A collapse freezes the vertices of
+// the faces around it for the rest of the pass, so the flip tests stay valid.
+///////////////////////////////////////////////////////////////////////////////
+
+// A level that keeps more than this fraction of the previous one ends the chain
+#define LOD_MIN_SHRINK 0.9f
+
+static bool lod_selection = true;
+
+bool get_lod_selection(void) {
+    return lod_selection;
+}
+
+void set_lod_selection(bool enabled) {
+    lod_selection = enabled;
+}
+
+typedef struct {
+    double a00, a01, a02, a11, a12, a22;  // symmetric matrix of the squared distance
+    double b0, b1, b2;
+    double c;
+    double weight;                        // total area of the planes
+} quadric_t;
+
+typedef struct {
+    int vertex;  // moves onto target
+    int target;
+    double error;
+} collapse_t;
+
+typedef struct {
+    const vec3_t* vertices;
+    size_t num_vertices;
+    int* indices;         // triangles of the current level
+    size_t num_triangles;
+    quadric_t* quadrics;
+    bool* locked;
+    int* twin;            // other vertex at the same position on a UV seam, -1 elsewhere
+    double max_error;     // largest collapse error so far, squared
+    int* first_triangle;  // triangles of each vertex, rebuilt every pass
+    int* vertex_triangles;
+    int* remap;
+    bool* frozen;
+    collapse_t* collapses;
+} simplifier_t;
+
+static void quadric_add_triangle(quadric_t* q, vec3_t p0, vec3_t p1, vec3_t p2) {
+    double e1[3] = { p1.x - p0.x, p1.y - p0.y, p1.z - p0.z };
+    double e2[3] = { p2.x - p0.x, p2.y - p0.y, p2.z - p0.z };
+    double n[3] = {
+        e1[1] * e2[2] - e1[2] * e2[1],
+        e1[2] * e2[0] - e1[0] * e2[2],
+        e1[0] * e2[1] - e1[1] * e2[0]
+    };
+    double length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (length == 0) {
+        return;
+    }
+    n[0] /= length;
+    n[1] /= length;
+    n[2] /= length;
+    double d = -(n[0] * p0.x + n[1] * p0.y + n[2] * p0.z);
+    double w = length * 0.5;
+
+    q->a00 += w * n[0] * n[0];
+    q->a01 += w * n[0] * n[1];
+    q->a02 += w * n[0] * n[2];
+    q->a11 += w * n[1] * n[1];
+    q->a12 += w * n[1] * n[2];
+    q->a22 += w * n[2] * n[2];
+    q->b0 += w * n[0] * d;
+    q->b1 += w * n[1] * d;
+    q->b2 += w * n[2] * d;
+    q->c += w * d * d;
+    q->weight += w;
+}
+
+static void quadric_add(quadric_t* q, const quadric_t* other) {
+    q->a00 += other->a00;
+    q->a01 += other->a01;
+    q->a02 += other->a02;
+    q->a11 += other->a11;
+    q->a12 += other->a12;
+    q->a22 += other->a22;
+    q->b0 += other->b0;
+    q->b1 += other->b1;
+    q->b2 += other->b2;
+    q->c += other->c;
+    q->weight += other->weight;
+}
+
+// Weighted sum of the squared distances of p to the planes of the quadric
+static double quadric_evaluate(const quadric_t* q, vec3_t p) {
+    double x = p.x, y = p.y, z = p.z;
+    return
+        q->a00 * x * x + q->a11 * y * y + q->a22 * z * z +
+        2 * (q->a01 * x * y + q->a02 * x * z + q->a12 * y * z) +
+        2 * (q->b0 * x + q->b1 * y + q->b2 * z) +
+        q->c;
+}
+
+static double collapse_error(const simplifier_t* s, int vertex, int target) {
+    const quadric_t* a = &s->quadrics[vertex];
+    const quadric_t* b = &s->quadrics[target];
+    double weight = a->weight + b->weight;
+    if (weight == 0) {
+        return 0;
+    }
+    double error = quadric_evaluate(a, s->vertices[target]) + quadric_evaluate(b, s->vertices[target]);
+    return fabs(error) / weight;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Find the seam twins and lock the vertices that may not move. Both are found
+// on the positions: two vertices that share a position are seam twins, and an
+// edge between two positions that no face uses in the other direction is an
+// open border.
+///////////////////////////////////////////////////////////////////////////////
+static const vec3_t* sorted_vertices;
+
+static int compare_positions(const void* a, const void* b) {
+    vec3_t pa = sorted_vertices[*(const int*)a];
+    vec3_t pb = sorted_vertices[*(const int*)b];
+    if (pa.x != pb.x) return pa.x < pb.x ? -1 : 1;
+    if (pa.y != pb.y) return pa.y < pb.y ? -1 : 1;
+    if (pa.z != pb.z) return pa.z < pb.z ? -1 : 1;
+    return 0;
+}
+
+static int compare_edges(const void* a, const void* b) {
+    uint64_t ea = *(const uint64_t*)a;
+    uint64_t eb = *(const uint64_t*)b;
+    return ea < eb ? -1 : (ea > eb ? 1 : 0);
+}
+
+static void classify_vertices(simplifier_t* s) {
+    size_t num_vertices = s->num_vertices;
+    size_t num_edges = s->num_triangles * 3;
+
+    // Number the distinct positions
+    int* order = (int*)malloc(sizeof(int) * num_vertices);
+    int* position = (int*)malloc(sizeof(int) * num_vertices);
+    for (size_t v = 0; v < num_vertices; v++) {
+        order[v] = (int)v;
+    }
+    sorted_vertices = s->vertices;
+    qsort(order, num_vertices, sizeof(int), compare_positions);
+    int num_positions = 0;
+    for (size_t i = 0; i < num_vertices; i++) {
+        if (i > 0 && compare_positions(&order[i - 1], &order[i]) != 0) {
+            num_positions++;
+        }
+        position[order[i]] = num_positions;
+    }
+    num_positions++;
+
+    // Pair the vertices of positions used exactly twice, lock the ones used more
+    bool* locked_position = (bool*)calloc(num_positions, sizeof(bool));
+    for (size_t v = 0; v < num_vertices; v++) {
+        s->twin[v] = -1;
+    }
+    for (size_t i = 0; i < num_vertices;) {
+        size_t count = 1;
+        while (i + count < num_vertices && position[order[i + count]] == position[order[i]]) {
+            count++;
+        }
+        if (count == 2) {
+            s->twin[order[i]] = order[i + 1];
+            s->twin[order[i + 1]] = order[i];
+        } else if (count > 2) {
+            locked_position[position[order[i]]] = true;
+        }
+        i += count;
+    }
+
+    // Directed edges between positions, sorted so the opposite edge can be searched
+    uint64_t* edges = (uint64_t*)malloc(sizeof(uint64_t) * (num_edges ? num_edges : 1));
+    for (size_t t = 0; t < s->num_triangles; t++) {
+        for (int k = 0; k < 3; k++) {
+            uint64_t a = position[s->indices[t * 3 + k]];
+            uint64_t b = position[s->indices[t * 3 + (k + 1) % 3]];
+            edges[t * 3 + k] = a << 32 | b;
+        }
+    }
+    qsort(edges, num_edges, sizeof(uint64_t), compare_edges);
+    for (size_t i = 0; i < num_edges; i++) {
+        uint64_t a = edges[i] >> 32;
+        uint64_t b = edges[i] & 0xFFFFFFFFu;
+        uint64_t opposite = b << 32 | a;
+        if (!bsearch(&opposite, edges, num_edges, sizeof(uint64_t), compare_edges)) {
+            locked_position[a] = true;
+            locked_position[b] = true;
+        }
+    }
+
+    for (size_t v = 0; v < num_vertices; v++) {
+        s->locked[v] = locked_position[position[v]];
+    }
+
+    free(edges);
+    free(locked_position);
+    free(position);
+    free(order);
+}
+
+// Whether moving vertex onto target turns over one of the faces that keep both
+static bool collapse_flips(const simplifier_t* s, int vertex, int target) {
+    for (int j = s->first_triangle[vertex]; j < s->first_triangle[vertex + 1]; j++) {
+        const int* t = &s->indices[s->vertex_triangles[j] * 3];
+        if (t[0] == target || t[1] == target || t[2] == target) {
+            continue;
+        }
+        vec3_t before[3], after[3];
+        for (int k = 0; k < 3; k++) {
+            before[k] = s->vertices[t[k]];
+            after[k] = t[k] == vertex ? s->vertices[target] : before[k];
+        }
+        vec3_t normal_before = vec3_cross(vec3_sub(before[1], before[0]), vec3_sub(before[2], before[0]));
+        vec3_t normal_after = vec3_cross(vec3_sub(after[1], after[0]), vec3_sub(after[2], after[0]));
+        if (vec3_dot(normal_before, normal_after) <= 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Number of faces using the edge between two vertices
+static int edge_faces(const simplifier_t* s, int a, int b) {
+    int count = 0;
+    for (int j = s->first_triangle[a]; j < s->first_triangle[a + 1]; j++) {
+        const int* t = &s->indices[s->vertex_triangles[j] * 3];
+        count += t[0] == b || t[1] == b || t[2] == b;
+    }
+    return count;
+}
+
+// Whether the edge from a seam vertex to target runs along the seam: target is
+// on the seam too, and the edge and the one between the twins are each used by
+// a single face, on their own side of the seam
+static bool seam_edge(const simplifier_t* s, int vertex, int target) {
+    return s->twin[target] >= 0 &&
+        edge_faces(s, vertex, target) == 1 &&
+        edge_faces(s, s->twin[vertex], s->twin[target]) == 1;
+}
+
+static int compare_collapses(const void* a, const void* b) {
+    double ea = ((const collapse_t*)a)->error;
+    double eb = ((const collapse_t*)b)->error;
+    return ea < eb ? -1 : (ea > eb ? 1 : 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// One pass of collapses, stopping once the level is down to the target.
+// Returns the number of collapses applied.
+///////////////////////////////////////////////////////////////////////////////
+static size_t simplify_pass(simplifier_t* s, size_t target_triangles) {
+    int num_vertices = (int)s->num_vertices;
+    int* indices = s->indices;
+
+    // Triangles of every vertex
+    memset(s->first_triangle, 0, sizeof(int) * (num_vertices + 1));
+    for (size_t i = 0; i < s->num_triangles * 3; i++) {
+        s->first_triangle[indices[i] + 1]++;
+    }
+    for (int v = 0; v < num_vertices; v++) {
+        s->first_triangle[v + 1] += s->first_triangle[v];
+    }
+    for (int v = 0; v < num_vertices; v++) {
+        s->remap[v] = s->first_triangle[v];  // fill cursor, reset below
+    }
+    for (size_t i = 0; i < s->num_triangles * 3; i++) {
+        s->vertex_triangles[s->remap[indices[i]]++] = (int)(i / 3);
+    }
+
+    // The cheapest collapse of every vertex that may move
+    size_t num_collapses = 0;
+    for (int u = 0; u < num_vertices; u++) {
+        if (s->locked[u]) {
+            continue;
+        }
+        int best = -1;
+        double best_error = DBL_MAX;
+        for (int j = s->first_triangle[u]; j < s->first_triangle[u + 1]; j++) {
+            const int* t = &indices[s->vertex_triangles[j] * 3];
+            for (int k = 0; k < 3; k++) {
+                int v = t[k];
+                if (v == u) {
+                    continue;
+                }
+                double error;
+                if (s->twin[u] < 0) {
+                    error = collapse_error(s, u, v);
+                } else if (seam_edge(s, u, v)) {
+                    error = collapse_error(s, u, v) + collapse_error(s, s->twin[u], s->twin[v]);
+                } else {
+                    continue;
+                }
+                if (error < best_error && !collapse_flips(s, u, v) &&
+                    (s->twin[u] < 0 || !collapse_flips(s, s->twin[u], s->twin[v]))) {
+                    best = v;
+                    best_error = error;
+                }
+            }
+        }
+        if (best >= 0) {
+            collapse_t collapse = { u, best, best_error };
+            s->collapses[num_collapses++] = collapse;
+        }
+    }
+    qsort(s->collapses, num_collapses, sizeof(collapse_t), compare_collapses);
+
+    for (int v = 0; v < num_vertices; v++) {
+        s->remap[v] = v;
+        s->frozen[v] = false;
+    }
+    size_t removed = 0;
+    size_t applied = 0;
+    for (size_t i = 0; i < num_collapses && removed + target_triangles < s->num_triangles; i++) {
+        int u = s->collapses[i].vertex;
+        int v = s->collapses[i].target;
+        bool seam = s->twin[u] >= 0;
+        if (s->frozen[u] || s->frozen[v] || (seam && (s->frozen[s->twin[u]] || s->frozen[s->twin[v]]))) {
+            continue;
+        }
+        if (s->collapses[i].error > s->max_error) {
+            s->max_error = s->collapses[i].error;
+        }
+
+        // A seam collapse moves both twins, each along its side of the seam
+        for (int side = 0; side < (seam ? 2 : 1); side++) {
+            int from = side == 0 ? u : s->twin[u];
+            int to = side == 0 ? v : s->twin[v];
+            s->remap[from] = to;
+            quadric_add(&s->quadrics[to], &s->quadrics[from]);
+            for (int j = s->first_triangle[from]; j < s->first_triangle[from + 1]; j++) {
+                const int* t = &indices[s->vertex_triangles[j] * 3];
+                if (t[0] == to || t[1] == to || t[2] == to) {
+                    removed++;
+                }
+                s->frozen[t[0]] = s->frozen[t[1]] = s->frozen[t[2]] = true;
+            }
+        }
+        applied++;
+    }
+
+    // Move the collapsed vertices and drop the faces that lost their area
+    size_t kept = 0;
+    for (size_t t = 0; t < s->num_triangles; t++) {
+        int a = s->remap[indices[t * 3 + 0]];
+        int b = s->remap[indices[t * 3 + 1]];
+        int c = s->remap[indices[t * 3 + 2]];
+        if (a == b || b == c || a == c) {
+            continue;
+        }
+        indices[kept * 3 + 0] = a;
+        indices[kept * 3 + 1] = b;
+        indices[kept * 3 + 2] = c;
+        kept++;
+    }
+    s->num_triangles = kept;
+    return applied;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Append the simplified levels of the mesh to its index buffer. Until then
+// the index buffer only holds the full mesh, which becomes level 0.
+///////////////////////////////////////////////////////////////////////////////
+void build_lod_chain(mesh_t* m) {
+    size_t num_triangles = mesh_num_triangles(m);
+    size_t num_vertices = array_length(m->vertices);
+
+    lod_t full_mesh = { 0, (int)num_triangles, 0, 0, 0.0f };
+    m->lods = NULL;
+    array_push(m->lods, full_mesh);
+    if (num_triangles <= LOD_MIN_TRIANGLES) {
+        return;
+    }
+
+    simplifier_t s;
+    s.vertices = m->vertices;
+    s.num_vertices = num_vertices;
+    s.num_triangles = num_triangles;
+    s.max_error = 0;
+    s.indices = (int*)malloc(sizeof(int) * num_triangles * 3);
+    s.quadrics = (quadric_t*)calloc(num_vertices, sizeof(quadric_t));
+    s.locked = (bool*)malloc(sizeof(bool) * num_vertices);
+    s.twin = (int*)malloc(sizeof(int) * num_vertices);
+    s.first_triangle = (int*)malloc(sizeof(int) * (num_vertices + 1));
+    s.vertex_triangles = (int*)malloc(sizeof(int) * num_triangles * 3);
+    s.remap = (int*)malloc(sizeof(int) * num_vertices);
+    s.frozen = (bool*)malloc(sizeof(bool) * num_vertices);
+    s.collapses = (collapse_t*)malloc(sizeof(collapse_t) * num_vertices);
+
+    for (size_t i = 0; i < num_triangles * 3; i++) {
+        s.indices[i] = mesh_index(m, i);
+    }
+    for (size_t t = 0; t < num_triangles; t++) {
+        int* tri = &s.indices[t * 3];
+        quadric_t plane = { 0 };
+        quadric_add_triangle(&plane, m->vertices[tri[0]], m->vertices[tri[1]], m->vertices[tri[2]]);
+        for (int k = 0; k < 3; k++) {
+            quadric_add(&s.quadrics[tri[k]], &plane);
+        }
+    }
+    classify_vertices(&s);
+
+    while (array_length(m->lods) < MAX_LODS && s.num_triangles > LOD_MIN_TRIANGLES) {
+        size_t previous = s.num_triangles;
+        size_t target = (size_t)(previous * LOD_REDUCTION);
+        while (s.num_triangles > target && simplify_pass(&s, target) > 0) {
+        }
+        if (s.num_triangles > previous * LOD_MIN_SHRINK) {
+            break;
+        }
+        if (array_length(m->indices) + s.num_triangles * 3 > MESH_MAX_INDICES) {
+            break;
+        }
+
+        lod_t lod;
+        lod.first_triangle = mesh_num_triangles(m);
+        lod.num_triangles = (int)s.num_triangles;
+        lod.first_meshlet = 0;
+        lod.num_meshlets = 0;
+        lod.error = m->bounds_radius > 0 ? (float)(sqrt(s.max_error) / m->bounds_radius) : 0.0f;
+
+        m->indices = array_hold(m->indices, s.num_triangles * 3, m->index_size);
+        for (size_t i = 0; i < s.num_triangles * 3; i++) {
+            mesh_set_index(m, lod.first_triangle * 3 + i, s.indices[i]);
+        }
+        if (get_mesh_optimization()) {
+            optimize_triangle_order(m, lod.first_triangle, lod.num_triangles);
+        }
+        array_push(m->lods, lod);
+
+        printf(
+            "LOD %zu: %d triangles, error %.3f%% of the radius\n",
+            array_length(m->lods) - 1, lod.num_triangles, lod.error * 100.0f
+        );
+    }
+
+    free(s.collapses);
+    free(s.frozen);
+    free(s.remap);
+    free(s.vertex_triangles);
+    free(s.first_triangle);
+    free(s.twin);
+    free(s.locked);
+    free(s.quadrics);
+    free(s.indices);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The coarsest level whose error, for a mesh whose bounding sphere covers
+// projected_radius pixels on screen, stays under LOD_PIXEL_ERROR pixels
+///////////////////////////////////////////////////////////////////////////////
+int select_lod(const mesh_t* m, float projected_radius) {
+    if (!lod_selection) {
+        return 0;
+    }
+    for (size_t i = array_length(m->lods); i > 1; i--) {
+        if (m->lods[i - 1].error * projected_radius <= LOD_PIXEL_ERROR) {
+            return (int)(i - 1);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include <stdbool.h>
+#include "mesh.h"
+
+#define MAX_LODS 16
+
+// Each level aims for this fraction of the triangles of the previous one
+#define LOD_REDUCTION 0.5f
+
+// No level is built from a level with this few triangles or less
+#define LOD_MIN_TRIANGLES 256
+
+// Largest error, in pixels, the selected level may show on screen
+#define LOD_PIXEL_ERROR 1.0f
+
+void build_lod_chain(mesh_t* m);
+int select_lod(const mesh_t* m, float projected_radius);
+
+bool get_lod_selection(void);
+void set_lod_selection(bool enabled);
+
+#endif
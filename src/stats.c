@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <SDL2/SDL.h>
+#include "stats.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Per-frame rasterizer statistics. The counters are atomic because every
+// rasterizer thread adds to them; the rasterizer accumulates locally and adds
+// once per triangle so the atomics stay off the per-pixel path.
+///////////////////////////////////////////////////////////////////////////////
+
+static SDL_atomic_t frame_fragments;          // covered pixels that reached the depth test
+static SDL_atomic_t frame_rejected_fragments; // covered pixels that failed it (early-z rejects)
+static SDL_atomic_t frame_hiz_rejected_blocks;
+static SDL_atomic_t frame_meshlets;
+static SDL_atomic_t frame_culled_meshlets;       // meshlets skipped by the frustum or normal cone test
+static SDL_atomic_t frame_objects;
+static SDL_atomic_t frame_culled_objects;        // objects whose bounds are outside the frustum
+static SDL_atomic_t frame_unclipped_objects;     // objects whose bounds are inside, drawn without clipping
+static SDL_atomic_t frame_faces;                 // faces of the visible meshlets
+static SDL_atomic_t frame_rejected_faces;        // faces dropped by their outcodes
+static SDL_atomic_t frame_clipped_faces;         // faces that went through clip_polygon
+
+// Frame arena usage, set once per frame by the main thread
+static size_t frame_arena_used;
+static size_t frame_arena_peak;
+static size_t frame_arena_capacity;
+static int frame_arena_block_allocations;  // mallocs since startup, constant once the arena fits every frame
+
+static bool print_stats = false;
+static Uint32 last_print_time = 0;
+
+void reset_frame_stats(void) {
+    SDL_AtomicSet(&frame_fragments, 0);
+    SDL_AtomicSet(&frame_rejected_fragments, 0);
+    SDL_AtomicSet(&frame_hiz_rejected_blocks, 0);
+    SDL_AtomicSet(&frame_meshlets, 0);
+    SDL_AtomicSet(&frame_culled_meshlets, 0);
+    SDL_AtomicSet(&frame_objects, 0);
+    SDL_AtomicSet(&frame_culled_objects, 0);
+    SDL_AtomicSet(&frame_unclipped_objects, 0);
+    SDL_AtomicSet(&frame_faces, 0);
+    SDL_AtomicSet(&frame_rejected_faces, 0);
+    SDL_AtomicSet(&frame_clipped_faces, 0);
+}
+
+void add_depth_test_stats(int fragments, int rejected) {
+    if (fragments > 0) {
+        SDL_AtomicAdd(&frame_fragments, fragments);
+    }
+    if (rejected > 0) {
+        SDL_AtomicAdd(&frame_rejected_fragments, rejected);
+    }
+}
+
+void add_hiz_rejected_blocks(int blocks) {
+    if (blocks > 0) {
+        SDL_AtomicAdd(&frame_hiz_rejected_blocks, blocks);
+    }
+}
+
+void add_meshlet_stats(int meshlets, int culled) {
+    SDL_AtomicAdd(&frame_meshlets, meshlets);
+    SDL_AtomicAdd(&frame_culled_meshlets, culled);
+}
+
+void add_object_stats(int objects, int culled, int unclipped) {
+    SDL_AtomicAdd(&frame_objects, objects);
+    SDL_AtomicAdd(&frame_culled_objects, culled);
+    SDL_AtomicAdd(&frame_unclipped_objects, unclipped);
+}
+
+void add_clip_stats(int faces, int rejected, int clipped) {
+    SDL_AtomicAdd(&frame_faces, faces);
+    SDL_AtomicAdd(&frame_rejected_faces, rejected);
+    SDL_AtomicAdd(&frame_clipped_faces, clipped);
+}
+
+void set_arena_stats(size_t used, size_t peak, size_t capacity, int block_allocations) {
+    frame_arena_used = used;
+    frame_arena_peak = peak;
+    frame_arena_capacity = capacity;
+    frame_arena_block_allocations = block_allocations;
+}
+
+int get_frame_fragments(void) {
+    return SDL_AtomicGet(&frame_fragments);
+}
+
+int get_frame_rejected_fragments(void) {
+    return SDL_AtomicGet(&frame_rejected_fragments);
+}
+
+int get_frame_hiz_rejected_blocks(void) {
+    return SDL_AtomicGet(&frame_hiz_rejected_blocks);
+}
+
+int get_frame_meshlets(void) {
+    return SDL_AtomicGet(&frame_meshlets);
+}
+
+int get_frame_culled_meshlets(void) {
+    return SDL_AtomicGet(&frame_culled_meshlets);
+}
+
+int get_frame_objects(void) {
+    return SDL_AtomicGet(&frame_objects);
+}
+
+int get_frame_culled_objects(void) {
+    return SDL_AtomicGet(&frame_culled_objects);
+}
+
+int get_frame_unclipped_objects(void) {
+    return SDL_AtomicGet(&frame_unclipped_objects);
+}
+
+int get_frame_faces(void) {
+    return SDL_AtomicGet(&frame_faces);
+}
+
+int get_frame_rejected_faces(void) {
+    return SDL_AtomicGet(&frame_rejected_faces);
+}
+
+int get_frame_clipped_faces(void) {
+    return SDL_AtomicGet(&frame_clipped_faces);
+}
+
+bool get_print_stats(void) {
+    return print_stats;
+}
+
+void set_print_stats(bool enabled) {
+    print_stats = enabled;
+}
+
+// Print the counters of the last frame, at most once per second
+void print_frame_stats(void) {
+    if (!print_stats || SDL_GetTicks() - last_print_time < 1000) {
+        return;
+    }
+    last_print_time = SDL_GetTicks();
+
+    int fragments = get_frame_fragments();
+    int rejected = get_frame_rejected_fragments();
+    printf(
+        "fragments: %d, early-z rejected: %d (%.1f%%), hi-z rejected blocks: %d, meshlets culled: %d of %d, "
+        "objects culled: %d of %d, unclipped: %d, faces outcode rejected: %d, clipped: %d of %d, "
+        "arena: %zu KB, peak %zu KB of %zu KB, blocks allocated: %d\n",
+        fragments, rejected, fragments ? 100.0 * rejected / fragments : 0.0, get_frame_hiz_rejected_blocks(),
+        get_frame_culled_meshlets(), get_frame_meshlets(),
+        get_frame_culled_objects(), get_frame_objects(), get_frame_unclipped_objects(),
+        get_frame_rejected_faces(), get_frame_clipped_faces(), get_frame_faces(),
+        frame_arena_used / 1024, frame_arena_peak / 1024, frame_arena_capacity / 1024, frame_arena_block_allocations
+    );
+}
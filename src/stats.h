@@ -0,0 +1,31 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+void reset_frame_stats(void);
+void add_depth_test_stats(int fragments, int rejected);
+void add_hiz_rejected_blocks(int blocks);
+void add_meshlet_stats(int meshlets, int culled);
+void add_object_stats(int objects, int culled, int unclipped);
+void add_clip_stats(int faces, int rejected, int clipped);
+void set_arena_stats(size_t used, size_t peak, size_t capacity, int block_allocations);
+
+int get_frame_fragments(void);
+int get_frame_rejected_fragments(void);
+int get_frame_hiz_rejected_blocks(void);
+int get_frame_meshlets(void);
+int get_frame_culled_meshlets(void);
+int get_frame_objects(void);
+int get_frame_culled_objects(void);
+int get_frame_unclipped_objects(void);
+int get_frame_faces(void);
+int get_frame_rejected_faces(void);
+int get_frame_clipped_faces(void);
+
+bool get_print_stats(void);
+void set_print_stats(bool enabled);
+void print_frame_stats(void);
+
+#endif
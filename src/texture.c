@@ -1,23 +1,51 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include "array.h"
+#include "texture.h"
 #include "upng.h"
 
-int texture_width = 64;
-int texture_height = 64;
+// Every texture loaded so far, looked up by file name
+static texture_t** textures = NULL;
 
-upng_t* png = NULL;
-uint32_t* mesh_texture = NULL;
+texture_t* load_png_texture(char* filename) {
+    for (size_t i = 0; i < array_length(textures); i++) {
+        if (strcmp(textures[i]->filename, filename) == 0) {
+            return textures[i];
+        }
+    }
 
-void load_png_texture_data(char* filename) {
-    png = upng_new_from_file(filename);
+    printf("Loading %s\n", filename);
+    upng_t* png = upng_new_from_file(filename);
+    if (png == NULL) {
+        fprintf(stderr, "Cannot read texture %s\n", filename);
+        return NULL;
+    }
+    upng_decode(png);
+    if (upng_get_error(png) != UPNG_EOK) {
+        fprintf(stderr, "Cannot decode texture %s\n", filename);
+        upng_free(png);
+        return NULL;
+    }
 
-    if (png != NULL) {
-        upng_decode(png);
-        
-        if (upng_get_error(png) == UPNG_EOK) {
-            mesh_texture = (uint32_t*)upng_get_buffer(png);
-            texture_width = upng_get_width(png);
-            texture_height = upng_get_height(png);
-        }
+    texture_t* texture = (texture_t*)malloc(sizeof(texture_t));
+    texture->pixels = (uint32_t*)upng_get_buffer(png);
+    texture->width = upng_get_width(png);
+    texture->height = upng_get_height(png);
+    texture->png = png;
+    texture->filename = strdup(filename);
+    array_push(textures, texture);
+    return texture;
+}
+
+void free_textures(void) {
+    for (size_t i = 0; i < array_length(textures); i++) {
+        upng_free(textures[i]->png);
+        free(textures[i]->filename);
+        free(textures[i]);
     }
+    array_free(textures);
+    textures = NULL;
 }
@@ -9,12 +9,19 @@ typedef struct {
     float v;
 } tex2_t;
 
-extern int texture_width;
-extern int texture_height;
-
-extern upng_t* png;
-extern uint32_t* mesh_texture;
+///////////////////////////////////////////////////////////////////////////////
+// A decoded PNG image. Textures are loaded once per file and shared by every
+// object that uses them.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    uint32_t* pixels;
+    int width;
+    int height;
+    upng_t* png;
+    char* filename;
+} texture_t;
 
-void load_png_texture_data(char* filename);
+texture_t* load_png_texture(char* filename);
+void free_textures(void);
 
 #endif
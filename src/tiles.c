@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <SDL2/SDL.h>
+#include "display.h"
+#include "rasterizer.h"
+#include "tiles.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Tile-binned multithreaded rasterization
+///////////////////////////////////////////////////////////////////////////////
+// The screen is split in TILE_SIZE x TILE_SIZE tiles. Every projected
+// triangle is first appended to the bin of each tile its bounding box
+// overlaps. The bins are filled in two passes, counting then storing, so
+// they all fit in one array taken from the frame arena. The worker threads
+// (and the main thread) then pick whole tiles from a shared counter and
+// rasterize the triangles of the tile's bin, in submission order, clipped to
+// the tile. A tile is only ever written by the thread that picked it, so the
+// color and z-buffers need no locks.
+//
+//   +------+------+------+
+//   |  T0  |  T1  |  T2  |    bin[T1] = { 4, 9 }
+//   |    /\|      |      |    bin[T4] = { 4 }
+//   +---/--\------+------+
+//   |  /  T4\     |  T5  |
+//   | /______\    |      |
+//   +------+------+------+
+//
+///////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    int first;       // position of the bin's first triangle index in bin_triangles
+    int num_triangles;
+} tile_bin_t;
+
+static tile_bin_t* bins = NULL;
+static int* bin_triangles = NULL;  // indices into the array of triangles of the frame, bin after bin
+static int num_tiles_x = 0;
+static int num_tiles_y = 0;
+
+static SDL_Thread** workers = NULL;
+static int num_workers = 0;
+static SDL_sem* work_ready = NULL;
+static SDL_sem* work_done = NULL;
+static SDL_atomic_t next_tile;
+static bool workers_quit = false;
+
+static bool tiled_rendering = true;
+
+// The frame being rasterized, shared with the workers
+static triangle_t* frame_triangles = NULL;
+static bool frame_textured = false;
+static bool frame_deferred = false;
+
+bool get_tiled_rendering(void) {
+    return tiled_rendering;
+}
+
+void set_tiled_rendering(bool enabled) {
+    tiled_rendering = enabled;
+}
+
+int get_tile_threads(void) {
+    return num_workers + 1;
+}
+
+static void render_tile(int tile) {
+    tile_bin_t* bin = &bins[tile];
+    if (bin->num_triangles == 0) {
+        return;
+    }
+
+    int tile_x = tile % num_tiles_x;
+    int tile_y = tile / num_tiles_x;
+    raster_rect_t clip = {
+        .min_x = tile_x * TILE_SIZE,
+        .min_y = tile_y * TILE_SIZE,
+        .max_x = tile_x * TILE_SIZE + TILE_SIZE - 1,
+        .max_y = tile_y * TILE_SIZE + TILE_SIZE - 1
+    };
+    if (clip.max_x > get_window_width() - 1) clip.max_x = get_window_width() - 1;
+    if (clip.max_y > get_window_height() - 1) clip.max_y = get_window_height() - 1;
+
+    for (int i = 0; i < bin->num_triangles; i++) {
+        int triangle_index = bin_triangles[bin->first + i];
+        triangle_t* triangle = &frame_triangles[triangle_index];
+        if (frame_deferred) {
+            rasterize_visibility_triangle(triangle, triangle_index, clip);
+        } else if (frame_textured) {
+            rasterize_textured_triangle(triangle, clip);
+        } else {
+            rasterize_filled_triangle(triangle, triangle->color, clip);
+        }
+    }
+
+    // The whole bin is in the visibility buffer: shade the visible pixels of the tile
+    if (frame_deferred) {
+        resolve_visibility(clip);
+    }
+}
+
+// Keep taking tiles until every tile of the frame has been picked by some thread
+static void render_pending_tiles(void) {
+    int num_tiles = num_tiles_x * num_tiles_y;
+    int tile;
+    while ((tile = SDL_AtomicAdd(&next_tile, 1)) < num_tiles) {
+        render_tile(tile);
+    }
+}
+
+static int worker_main(void* data) {
+    (void)data;
+    while (true) {
+        SDL_SemWait(work_ready);
+        if (workers_quit) {
+            break;
+        }
+        render_pending_tiles();
+        SDL_SemPost(work_done);
+    }
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Allocate the tile bins and start the worker pool. The main thread takes part
+// in the rasterization, so num_threads - 1 workers are created. A value of 0
+// or less uses one thread per CPU.
+///////////////////////////////////////////////////////////////////////////////
+bool init_tiles(int num_threads) {
+    if (num_threads <= 0) {
+        num_threads = SDL_GetCPUCount();
+    }
+
+    num_tiles_x = (get_window_width() + TILE_SIZE - 1) / TILE_SIZE;
+    num_tiles_y = (get_window_height() + TILE_SIZE - 1) / TILE_SIZE;
+    bins = (tile_bin_t*)calloc(num_tiles_x * num_tiles_y, sizeof(tile_bin_t));
+    if (!bins) {
+        fprintf(stderr, "Cannot allocate the tile bins\n");
+        return false;
+    }
+
+    work_ready = SDL_CreateSemaphore(0);
+    work_done = SDL_CreateSemaphore(0);
+    workers = (SDL_Thread**)calloc(num_threads, sizeof(SDL_Thread*));
+    num_workers = 0;
+    for (int i = 0; i < num_threads - 1; i++) {
+        workers[i] = SDL_CreateThread(worker_main, "raster", NULL);
+        if (!workers[i]) {
+            fprintf(stderr, "Cannot create rasterizer thread, using %d\n", num_workers + 1);
+            break;
+        }
+        num_workers++;
+    }
+    return true;
+}
+
+void destroy_tiles(void) {
+    workers_quit = true;
+    for (int i = 0; i < num_workers; i++) {
+        SDL_SemPost(work_ready);
+    }
+    for (int i = 0; i < num_workers; i++) {
+        SDL_WaitThread(workers[i], NULL);
+    }
+    num_workers = 0;
+    free(workers);
+    SDL_DestroySemaphore(work_ready);
+    SDL_DestroySemaphore(work_done);
+
+    free(bins);
+    bins = NULL;
+}
+
+// Range of the tiles overlapped by the bounding box of the triangle, false if it is off screen
+static bool triangle_tiles(const triangle_t* triangle, int* tile_x0, int* tile_y0, int* tile_x1, int* tile_y1) {
+    int min_x = triangle->points[0].x, max_x = min_x;
+    int min_y = triangle->points[0].y, max_y = min_y;
+    for (int i = 1; i < 3; i++) {
+        int x = triangle->points[i].x;
+        int y = triangle->points[i].y;
+        if (x < min_x) min_x = x;
+        if (x > max_x) max_x = x;
+        if (y < min_y) min_y = y;
+        if (y > max_y) max_y = y;
+    }
+    if (max_x < 0 || max_y < 0 || min_x >= get_window_width() || min_y >= get_window_height()) {
+        return false;
+    }
+    if (min_x < 0) min_x = 0;
+    if (min_y < 0) min_y = 0;
+    if (max_x > get_window_width() - 1) max_x = get_window_width() - 1;
+    if (max_y > get_window_height() - 1) max_y = get_window_height() - 1;
+
+    *tile_x0 = min_x / TILE_SIZE;
+    *tile_y0 = min_y / TILE_SIZE;
+    *tile_x1 = max_x / TILE_SIZE;
+    *tile_y1 = max_y / TILE_SIZE;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Append every triangle to the bins of the tiles it overlaps, in submission
+// order. The first pass counts the triangles of each bin to place the bins
+// one after the other, the second stores the indices.
+///////////////////////////////////////////////////////////////////////////////
+static void bin_triangles_of_frame(triangle_t* triangles, int num_triangles, arena_t* arena) {
+    int num_tiles = num_tiles_x * num_tiles_y;
+    for (int i = 0; i < num_tiles; i++) {
+        bins[i].num_triangles = 0;
+    }
+
+    int x0, y0, x1, y1;
+    for (int i = 0; i < num_triangles; i++) {
+        if (triangle_tiles(&triangles[i], &x0, &y0, &x1, &y1)) {
+            for (int tile_y = y0; tile_y <= y1; tile_y++) {
+                for (int tile_x = x0; tile_x <= x1; tile_x++) {
+                    bins[tile_y * num_tiles_x + tile_x].num_triangles++;
+                }
+            }
+        }
+    }
+
+    int total = 0;
+    for (int i = 0; i < num_tiles; i++) {
+        bins[i].first = total;
+        total += bins[i].num_triangles;
+        bins[i].num_triangles = 0;
+    }
+    bin_triangles = (int*)arena_alloc(arena, sizeof(int) * (total ? total : 1));
+
+    for (int i = 0; i < num_triangles; i++) {
+        if (triangle_tiles(&triangles[i], &x0, &y0, &x1, &y1)) {
+            for (int tile_y = y0; tile_y <= y1; tile_y++) {
+                for (int tile_x = x0; tile_x <= x1; tile_x++) {
+                    tile_bin_t* bin = &bins[tile_y * num_tiles_x + tile_x];
+                    bin_triangles[bin->first + bin->num_triangles++] = i;
+                }
+            }
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Bin the triangles of the frame and rasterize all the tiles in parallel.
+// With deferred texturing, each tile runs the visibility pass over its bin
+// and then resolves its own pixels. Returns once every tile has been rendered.
+// The bins and the shading planes are taken from the frame arena.
+///////////////////////////////////////////////////////////////////////////////
+void render_tiles(triangle_t* triangles, int num_triangles, bool textured, bool deferred, arena_t* arena) {
+    bin_triangles_of_frame(triangles, num_triangles, arena);
+
+    frame_triangles = triangles;
+    frame_textured = textured;
+    frame_deferred = textured && deferred;
+    if (frame_deferred) {
+        setup_visibility_triangles(triangles, num_triangles, arena);
+    }
+    SDL_AtomicSet(&next_tile, 0);
+
+    for (int i = 0; i < num_workers; i++) {
+        SDL_SemPost(work_ready);
+    }
+    render_pending_tiles();
+    for (int i = 0; i < num_workers; i++) {
+        SDL_SemWait(work_done);
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef TILES_H
+#define TILES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "arena.h"
+#include "triangle.h"
+
+#define TILE_SIZE 64
+
+bool init_tiles(int num_threads);
+void destroy_tiles(void);
+
+bool get_tiled_rendering(void);
+void set_tiled_rendering(bool enabled);
+int get_tile_threads(void);
+
+void render_tiles(triangle_t* triangles, int num_triangles, bool textured, bool deferred, arena_t* arena);
+
+#endif
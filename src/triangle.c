@@ -1,3 +1,5 @@
+#include <stdlib.h>
+#include <string.h>
 #include "display.h"
 #include "swap.h"
 #include "triangle.h"
@@ -74,7 +76,7 @@ void draw_triangle_pixel(
     float interpolated_reciprocal_w = (1 / point_a.w) * alpha + (1 / point_b.w) * beta + (1 / point_c.w) * gamma;
 
     // Adjust 1/w so the pixels that are closer to the camera have smaller values
-    interpolated_reciprocal_w = 1.0 - interpolated_reciprocal_w;
+    interpolated_reciprocal_w = encode_depth(interpolated_reciprocal_w);
 
     // Only draw the pixel if the depth value is less than the one previously stored in the z-buffer
     if (interpolated_reciprocal_w < z_buffer[(get_window_width() * y) + x]) {
@@ -90,7 +92,7 @@ void draw_triangle_pixel(
 // Function to draw the textured pixel at position (x,y) using depth interpolation
 ///////////////////////////////////////////////////////////////////////////////
 void draw_triangle_texel(
-    int x, int y, uint32_t* texture,
+    int x, int y, const texture_t* texture,
     vec4_t point_a, vec4_t point_b, vec4_t point_c,
     tex2_t a_uv, tex2_t b_uv, tex2_t c_uv
 ) {
@@ -123,16 +125,16 @@ void draw_triangle_texel(
     interpolated_v /= interpolated_reciprocal_w;
 
     // Map the UV coordinate to the full texture width and height
-    int tex_x = abs((int)(interpolated_u * texture_width)) % texture_width;
-    int tex_y = abs((int)(interpolated_v * texture_height)) % texture_height;
+    int tex_x = abs((int)(interpolated_u * texture->width)) % texture->width;
+    int tex_y = abs((int)(interpolated_v * texture->height)) % texture->height;
 
     // Adjust 1/w so the pixels that are closer to the camera have smaller values
-    interpolated_reciprocal_w = 1.0 - interpolated_reciprocal_w;
+    interpolated_reciprocal_w = encode_depth(interpolated_reciprocal_w);
 
     // Only draw the pixel if the depth value is less than the one previously stored in the z-buffer
     if (interpolated_reciprocal_w < z_buffer[(get_window_width() * y) + x]) {
         // Draw a pixel at position (x,y) with the color that comes from the mapped texture
-        draw_pixel(x, y, texture[(texture_width * tex_y) + tex_x]);
+        draw_pixel(x, y, texture->pixels[(texture->width * tex_y) + tex_x]);
 
         // Update the z-buffer value with the 1/w of this current pixel
         z_buffer[(get_window_width() * y) + x] = interpolated_reciprocal_w;
@@ -163,7 +165,7 @@ void draw_textured_triangle(
     int x0, int y0, float z0, float w0, float u0, float v0,
     int x1, int y1, float z1, float w1, float u1, float v1,
     int x2, int y2, float z2, float w2, float u2, float v2,
-    uint32_t* texture
+    const texture_t* texture
 ) {
     // We need to sort the vertices by y-coordinate ascending (y0 < y1 < y2)
     if (y0 > y1) {
@@ -214,7 +216,7 @@ void draw_textured_triangle(
     if (y2 - y0 != 0) inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
 
     if (y1 - y0 != 0) {
-        for (int y = y0; y <= y1; y++) {
+        for (int y = y0 > 0 ? y0 : 0; y <= y1 && y < get_window_height(); y++) {
             int x_start = x1 + (y - y1) * inv_slope_1;
             int x_end = x0 + (y - y0) * inv_slope_2;
 
@@ -222,6 +224,10 @@ void draw_textured_triangle(
                 int_swap(&x_start, &x_end); // swap if x_start is to the right of x_end
             }
 
+            // Scissor the span to the screen, the triangle may reach into the guard band
+            if (x_start < 0) x_start = 0;
+            if (x_end > get_window_width()) x_end = get_window_width();
+
             for (int x = x_start; x < x_end; x++) {
                 // Draw our pixel with the color that comes from the texture
                 draw_triangle_texel(x, y, texture, point_a, point_b, point_c, a_uv, b_uv, c_uv);
@@ -239,7 +245,7 @@ void draw_textured_triangle(
     if (y2 - y0 != 0) inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
 
     if (y2 - y1 != 0) {
-        for (int y = y1; y <= y2; y++) {
+        for (int y = y1 > 0 ? y1 : 0; y <= y2 && y < get_window_height(); y++) {
             int x_start = x1 + (y - y1) * inv_slope_1;
             int x_end = x0 + (y - y0) * inv_slope_2;
 
@@ -247,6 +253,10 @@ void draw_textured_triangle(
                 int_swap(&x_start, &x_end); // swap if x_start is to the right of x_end
             }
 
+            // Scissor the span to the screen, the triangle may reach into the guard band
+            if (x_start < 0) x_start = 0;
+            if (x_end > get_window_width()) x_end = get_window_width();
+
             for (int x = x_start; x < x_end; x++) {
                 // Draw our pixel with the color that comes from the texture
                 draw_triangle_texel(x, y, texture, point_a, point_b, point_c, a_uv, b_uv, c_uv);
@@ -319,7 +329,7 @@ void draw_filled_triangle(
     if (y2 - y0 != 0) inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
 
     if (y1 - y0 != 0) {
-        for (int y = y0; y <= y1; y++) {
+        for (int y = y0 > 0 ? y0 : 0; y <= y1 && y < get_window_height(); y++) {
             int x_start = x1 + (y - y1) * inv_slope_1;
             int x_end = x0 + (y - y0) * inv_slope_2;
 
@@ -327,6 +337,10 @@ void draw_filled_triangle(
                 int_swap(&x_start, &x_end); // swap if x_start is to the right of x_end
             }
 
+            // Scissor the span to the screen, the triangle may reach into the guard band
+            if (x_start < 0) x_start = 0;
+            if (x_end > get_window_width()) x_end = get_window_width();
+
             for (int x = x_start; x < x_end; x++) {
                 // Draw our pixel with a solid color
                 draw_triangle_pixel(x, y, color, point_a, point_b, point_c);
@@ -344,7 +358,7 @@ void draw_filled_triangle(
     if (y2 - y0 != 0) inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
 
     if (y2 - y1 != 0) {
-        for (int y = y1; y <= y2; y++) {
+        for (int y = y1 > 0 ? y1 : 0; y <= y2 && y < get_window_height(); y++) {
             int x_start = x1 + (y - y1) * inv_slope_1;
             int x_end = x0 + (y - y0) * inv_slope_2;
 
@@ -352,6 +366,10 @@ void draw_filled_triangle(
                 int_swap(&x_start, &x_end); // swap if x_start is to the right of x_end
             }
 
+            // Scissor the span to the screen, the triangle may reach into the guard band
+            if (x_start < 0) x_start = 0;
+            if (x_end > get_window_width()) x_end = get_window_width();
+
             for (int x = x_start; x < x_end; x++) {
                 // Draw our pixel with a solid color
                 draw_triangle_pixel(x, y, color, point_a, point_b, point_c);
@@ -359,3 +377,67 @@ void draw_filled_triangle(
         }
     }
 }
+
+///////////////////////////////////////////////////////////////////////////////
+// Sort projected triangles front to back, so the nearest surfaces fill the
+// z-buffer first and the depth test rejects the fragments hidden behind them
+// before any shading. The key is the depth of the nearest vertex (1 - 1/w,
+// the value stored in the z-buffer) quantized to 16 bits, sorted with a
+// stable two-pass LSD radix sort of 8 bits per pass. The keys, the order
+// and the sorted copy are taken from the scratch arena.
+///////////////////////////////////////////////////////////////////////////////
+#define DEPTH_SORT_BITS 16
+#define DEPTH_SORT_RADIX 256
+
+static uint16_t triangle_depth_key(const triangle_t* triangle) {
+    float max_reciprocal_w = 0;
+    for (int i = 0; i < 3; i++) {
+        float reciprocal_w = 1 / triangle->points[i].w;
+        if (reciprocal_w > max_reciprocal_w) max_reciprocal_w = reciprocal_w;
+    }
+    float depth = 1.0 - max_reciprocal_w;
+    if (depth < 0) depth = 0;
+    if (depth > 1) depth = 1;
+    return (uint16_t)(depth * ((1 << DEPTH_SORT_BITS) - 1));
+}
+
+void sort_triangles_front_to_back(triangle_t* triangles, int num_triangles, arena_t* scratch) {
+    if (num_triangles < 2) {
+        return;
+    }
+    uint16_t* sort_keys = (uint16_t*)arena_alloc(scratch, sizeof(uint16_t) * num_triangles);
+    int* sort_order = (int*)arena_alloc(scratch, sizeof(int) * num_triangles);
+    int* sort_order_tmp = (int*)arena_alloc(scratch, sizeof(int) * num_triangles);
+    triangle_t* sort_triangles = (triangle_t*)arena_alloc(scratch, sizeof(triangle_t) * num_triangles);
+
+    for (int i = 0; i < num_triangles; i++) {
+        sort_keys[i] = triangle_depth_key(&triangles[i]);
+        sort_order[i] = i;
+    }
+
+    // Low byte first, then high byte; each pass is a stable counting sort of the order array
+    for (int shift = 0; shift < DEPTH_SORT_BITS; shift += 8) {
+        int offsets[DEPTH_SORT_RADIX] = { 0 };
+        for (int i = 0; i < num_triangles; i++) {
+            offsets[(sort_keys[i] >> shift) & 0xFF]++;
+        }
+        int total = 0;
+        for (int digit = 0; digit < DEPTH_SORT_RADIX; digit++) {
+            int count = offsets[digit];
+            offsets[digit] = total;
+            total += count;
+        }
+        for (int i = 0; i < num_triangles; i++) {
+            int index = sort_order[i];
+            sort_order_tmp[offsets[(sort_keys[index] >> shift) & 0xFF]++] = index;
+        }
+        int* tmp = sort_order;
+        sort_order = sort_order_tmp;
+        sort_order_tmp = tmp;
+    }
+
+    for (int i = 0; i < num_triangles; i++) {
+        sort_triangles[i] = triangles[sort_order[i]];
+    }
+    memcpy(triangles, sort_triangles, sizeof(triangle_t) * num_triangles);
+}
@@ -1,14 +1,16 @@
 #ifndef TRIANGLE_H
 #define TRIANGLE_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include "arena.h"
 #include "texture.h"
 #include "vector.h"
 
 typedef struct {
-    int a;
-    int b;
-    int c;
+    size_t a;
+    size_t b;
+    size_t c;
     tex2_t a_uv;
     tex2_t b_uv;
     tex2_t c_uv;
@@ -19,6 +21,7 @@ typedef struct {
     vec4_t points[3];
     tex2_t texcoords[3];
     uint32_t color;
+    const texture_t* texture;  // shared by every triangle of the object it comes from
 } triangle_t;
 
 void draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color);
@@ -38,15 +41,17 @@ void draw_textured_triangle(
     int x0, int y0, float z0, float w0, float u0, float v0, 
     int x1, int y1, float z1, float w1, float u1, float v1,
     int x2, int y2, float z2, float w2, float u2, float v2, 
-    uint32_t* texture
+    const texture_t* texture
 );
 
 void draw_triangle_texel(
-    int x, int y, uint32_t* texture, 
+    int x, int y, const texture_t* texture,
     vec4_t point_a, vec4_t point_b, vec4_t point_c,
     tex2_t a_uv, tex2_t b_uv, tex2_t c_uv
 );
 
 vec3_t barycentric_weights(vec2_t a, vec2_t b, vec2_t c, vec2_t p);
 
+void sort_triangles_front_to_back(triangle_t* triangles, int num_triangles, arena_t* scratch);
+
 #endif
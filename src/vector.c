@@ -1,4 +1,8 @@
 #include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include "vector.h"
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -171,3 +175,70 @@ vec2_t vec2_from_vec4(vec4_t v) {
     vec2_t result = { v.x, v.y };
     return result;
 }
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations of structure-of-arrays functions
+///////////////////////////////////////////////////////////////////////////////
+// All the streams of a vector share a single zeroed allocation; each one
+// starts on a SOA_ALIGNMENT boundary and is padded with zeros to the next one.
+static bool soa_alloc(int count, int num_streams, float** streams[], int* padded, void** memory) {
+    int lanes = SOA_ALIGNMENT / sizeof(float);
+    *padded = (count + lanes - 1) / lanes * lanes;
+    size_t stream_size = sizeof(float) * (*padded);
+
+    *memory = calloc(1, stream_size * num_streams + SOA_ALIGNMENT);
+    if (!*memory) {
+        for (int i = 0; i < num_streams; i++) {
+            *streams[i] = NULL;
+        }
+        return false;
+    }
+    uintptr_t address = ((uintptr_t)*memory + SOA_ALIGNMENT - 1) & ~(uintptr_t)(SOA_ALIGNMENT - 1);
+    for (int i = 0; i < num_streams; i++) {
+        *streams[i] = (float*)(address + stream_size * i);
+    }
+    return true;
+}
+
+vec3_soa_t vec3_soa_new(int count) {
+    vec3_soa_t soa = { .count = count };
+    float** streams[] = { &soa.x, &soa.y, &soa.z };
+    if (!soa_alloc(count, 3, streams, &soa.padded, &soa.memory)) {
+        soa.count = 0;
+    }
+    return soa;
+}
+
+vec3_soa_t vec3_soa_from_vec3(vec3_t* vectors, int count) {
+    vec3_soa_t soa = vec3_soa_new(count);
+    for (int i = 0; i < soa.count; i++) {
+        soa.x[i] = vectors[i].x;
+        soa.y[i] = vectors[i].y;
+        soa.z[i] = vectors[i].z;
+    }
+    return soa;
+}
+
+void vec3_soa_free(vec3_soa_t* soa) {
+    free(soa->memory);
+    memset(soa, 0, sizeof(*soa));
+}
+
+vec4_soa_t vec4_soa_new(int count) {
+    vec4_soa_t soa = { .count = count };
+    float** streams[] = { &soa.x, &soa.y, &soa.z, &soa.w };
+    if (!soa_alloc(count, 4, streams, &soa.padded, &soa.memory)) {
+        soa.count = 0;
+    }
+    return soa;
+}
+
+vec4_t vec4_soa_get(const vec4_soa_t* soa, int index) {
+    vec4_t result = { soa->x[index], soa->y[index], soa->z[index], soa->w[index] };
+    return result;
+}
+
+void vec4_soa_free(vec4_soa_t* soa) {
+    free(soa->memory);
+    memset(soa, 0, sizeof(*soa));
+}
@@ -14,6 +14,33 @@ typedef struct {
     float x, y, z, w;
 } vec4_t;
 
+// Streams are aligned to and padded to whole multiples of this many bytes,
+// so batched routines can use aligned vector loads on every element, padding included
+#define SOA_ALIGNMENT 32
+
+///////////////////////////////////////////////////////////////////////////////
+// Structure-of-arrays vectors: one float stream per component, so N
+// consecutive values of a component are one vector load away
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    float* x;
+    float* y;
+    float* z;
+    int count;     // number of vectors
+    int padded;    // length of each stream, a multiple of SOA_ALIGNMENT / sizeof(float)
+    void* memory;  // unaligned allocation holding all the streams
+} vec3_soa_t;
+
+typedef struct {
+    float* x;
+    float* y;
+    float* z;
+    float* w;
+    int count;
+    int padded;
+    void* memory;
+} vec4_soa_t;
+
 
 vec2_t vec2_new(float x, float y);
 vec3_t vec3_new(float x, float y, float z);
@@ -45,4 +72,11 @@ vec3_t vec3_clone(vec3_t* v);
 vec4_t vec4_from_vec3(vec3_t v);
 vec3_t vec3_from_vec4(vec4_t v);
 vec2_t vec2_from_vec4(vec4_t v);
+
+vec3_soa_t vec3_soa_new(int count);
+vec3_soa_t vec3_soa_from_vec3(vec3_t* vectors, int count);
+void vec3_soa_free(vec3_soa_t* soa);
+vec4_soa_t vec4_soa_new(int count);
+vec4_t vec4_soa_get(const vec4_soa_t* soa, int index);
+void vec4_soa_free(vec4_soa_t* soa);
 #endif
\ No newline at end of file